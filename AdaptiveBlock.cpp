@@ -0,0 +1,336 @@
+#include "AdaptiveBlock.h"
+#include "QueryThrottle.h"
+
+#include <QRegularExpression>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlRecord>
+
+//! more rows are not preloaded, the block uses batches instead
+static const qint32 maxPreloadRows = 500000;
+//! the maximum number of rows kept by the result cache
+static const quint64 maxCacheRows = 1000000;
+
+AdaptiveBlock::AdaptiveBlock(const QString &aName, const QString &aSql, const BlockStatistic &aLast)
+    : name(aName),
+      baseSql(""),
+      keyColumn(""),
+      keyField(""),
+      keyVariable(""),
+      last(aLast),
+      strategy(PerRow),
+      reason(""),
+      batchSize(200),
+      loaded(false),
+      lastError(""),
+      groups(),
+      cachedRowCount(0),
+      calls(0),
+      rows(0),
+      nanos(0),
+      tableRows(0),
+      sqlHashes()
+{
+    if (splitKeyFilter(aSql, baseSql, keyColumn, keyVariable))
+    {
+        keyField = keyColumn.mid(keyColumn.lastIndexOf('.') + 1);
+    }
+}
+
+//! Split a query ending with WHERE <column> = ${<var>} into the part before
+//! the WHERE, the column and the variable name.
+//! \return false if the query has no such key filter
+bool AdaptiveBlock::splitKeyFilter(const QString &aSql, QString &aBaseSql, QString &aColumn, QString &aVariable)
+{
+    static const QRegularExpression keyFilter(
+                "^\\s*(.*\\S)\\s+WHERE\\s+([A-Za-z_][\\w.]*)\\s*=\\s*('?)\\$\\{([A-Za-z_]\\w*)\\}\\3\\s*$",
+                QRegularExpression::CaseInsensitiveOption | QRegularExpression::DotMatchesEverythingOption);
+
+    QRegularExpressionMatch m = keyFilter.match(aSql);
+    if (!m.hasMatch() || m.captured(4).startsWith("__"))
+    {
+        return false;
+    }
+
+    aBaseSql = m.captured(1);
+    aColumn = m.captured(2);
+    aVariable = m.captured(4);
+
+    return true;
+}
+
+QString AdaptiveBlock::strategyName(Strategy s)
+{
+    switch (s)
+    {
+    case InList:  return "INLIST";
+    case Preload: return "PRELOAD";
+    case Cache:   return "CACHE";
+    default:      return "PERROW";
+    }
+}
+
+//! Select the strategy using the statistics of the last run.
+//! \param aForced is the strategy given at the block options or empty
+void AdaptiveBlock::choose(const QString &aForced)
+{
+    bool keyFilter = !keyVariable.isEmpty();
+
+    if (!aForced.isEmpty())
+    {
+        QString f = aForced.toUpper();
+        strategy = "INLIST" == f ? InList : "PRELOAD" == f ? Preload : "CACHE" == f ? Cache : PerRow;
+        reason = "set at the block options";
+        if (!keyFilter && (InList == strategy || Preload == strategy))
+        {
+            strategy = PerRow;
+            reason = QString("%1 needs a query ending with WHERE <column> = ${<var>}").arg(f);
+        }
+        return;
+    }
+
+    if (last.calls < 10)
+    {
+        strategy = PerRow;
+        reason = QString("only %1 calls at the last run").arg(last.calls);
+        return;
+    }
+
+    double avgMs = static_cast<double>(last.nanos) / last.calls / 1000000.0;
+    if (keyFilter && last.distinct >= 100 && (0 == last.tableRows || last.tableRows <= 10 * last.rows))
+    {
+        strategy = Preload;
+        reason = QString("%1 different keys, %2")
+                .arg(last.distinct)
+                .arg(0 == last.tableRows ? QString("table size unknown")
+                                         : QString("the table has %1 rows").arg(last.tableRows));
+    }
+    else if (keyFilter && last.distinct >= 10)
+    {
+        strategy = InList;
+        reason = QString("%1 different keys with %2 ms per call, read in batches of %3")
+                .arg(last.distinct).arg(avgMs, 0, 'f', 2).arg(batchSize);
+    }
+    else if (2 * last.distinct <= last.calls)
+    {
+        strategy = Cache;
+        reason = QString("%1 calls use only %2 different statements").arg(last.calls).arg(last.distinct);
+    }
+    else
+    {
+        strategy = PerRow;
+        reason = QString("%1 calls with %2 different statements and no key filter")
+                .arg(last.calls).arg(last.distinct);
+    }
+}
+
+//! Use a query for every call, the rows in memory are removed.
+void AdaptiveBlock::fallback(const QString &aReason)
+{
+    strategy = PerRow;
+    reason = aReason;
+    groups.clear();
+    cachedRowCount = 0;
+}
+
+//! \return the rows for the key (the SQL for the cache strategy) or
+//! nullptr if they aren't in memory
+RowSource *AdaptiveBlock::cachedRows(const QString &aKey)
+{
+    if (Preload == strategy && loaded)
+    {
+        return new MemoryRowSource(groups.value(aKey));
+    }
+
+    if (InList == strategy && groups.contains(aKey))
+    {
+        // every key is requested once per batch
+        QList<RowSource::Row> r = groups.take(aKey);
+        cachedRowCount -= r.size();
+        return new MemoryRowSource(r);
+    }
+
+    if (Cache == strategy && groups.contains(aKey))
+    {
+        return new MemoryRowSource(groups.value(aKey));
+    }
+
+    return nullptr;
+}
+
+//! Read the rows of the executed query and keep them for the same SQL.
+RowSource *AdaptiveBlock::cacheQuery(QSqlQuery &aQuery, const QString &aSql)
+{
+    QSqlRecord rec = aQuery.record();
+    QStringList fieldNames;
+    for (int i = 0; i < rec.count(); ++i)
+    {
+        fieldNames << rec.fieldName(i);
+    }
+
+    QList<RowSource::Row> result;
+    while (aQuery.next())
+    {
+        RowSource::Row r;
+        r.fields = fieldNames;
+        for (int i = 0; i < fieldNames.size(); ++i)
+        {
+            r.values << aQuery.value(i);
+        }
+        result << r;
+    }
+    aQuery.finish();
+
+    if (cachedRowCount + result.size() <= maxCacheRows)
+    {
+        groups.insert(aSql, result);
+        cachedRowCount += result.size();
+    }
+
+    return new MemoryRowSource(result);
+}
+
+//! Group the rows of the query by the value of the key field.
+//! \return false if the key field is missing or there are more than aMaxRows rows
+bool AdaptiveBlock::groupRows(QSqlQuery &aQuery, qint32 aMaxRows)
+{
+    QSqlRecord rec = aQuery.record();
+    qint32 keyIndex = rec.indexOf(keyField);
+    if (keyIndex < 0)
+    {
+        lastError = QString("the key column %1 isn't part of the result").arg(keyField);
+        return false;
+    }
+
+    QStringList fieldNames;
+    for (int i = 0; i < rec.count(); ++i)
+    {
+        fieldNames << rec.fieldName(i);
+    }
+
+    qint32 cnt = 0;
+    while (aQuery.next())
+    {
+        if (aMaxRows > 0 && ++cnt > aMaxRows)
+        {
+            lastError = QString("the table has more than %1 rows").arg(aMaxRows);
+            aQuery.finish();
+            return false;
+        }
+
+        RowSource::Row r;
+        r.fields = fieldNames;
+        for (int i = 0; i < fieldNames.size(); ++i)
+        {
+            r.values << aQuery.value(i);
+        }
+        groups[r.values.at(keyIndex).toString()] << r;
+        cachedRowCount++;
+    }
+    aQuery.finish();
+
+    return true;
+}
+
+//! Read the whole table once, without the key filter.
+//! \param aBaseSql the SQL without the key filter and all variables replaced
+bool AdaptiveBlock::preload(QSqlDatabase aDb, const QString &aBaseSql)
+{
+    QSqlQuery q(aDb);
+    q.setForwardOnly(true);
+    loaded = true;
+
+    bool ok = false;
+    {
+        ThrottleGuard guard(aDb);
+        ok = q.exec(aBaseSql);
+    }
+    if (!ok)
+    {
+        lastError = QString("%1 (%2)").arg(aBaseSql, q.lastError().text());
+        fallback(QString("preload failed"));
+        return false;
+    }
+
+    if (!groupRows(q, maxPreloadRows))
+    {
+        tableRows = maxPreloadRows + 1;
+        groups.clear();
+        cachedRowCount = 0;
+        strategy = InList;
+        reason = QString("preload not possible, %1").arg(lastError);
+        lastError.clear();
+        return false;
+    }
+
+    tableRows = cachedRowCount;
+    return true;
+}
+
+//! Read the rows for all keys with a single IN list query.
+bool AdaptiveBlock::fetchKeys(QSqlDatabase aDb, const QString &aBaseSql, const QStringList &aKeys)
+{
+    QStringList marks;
+    for (qsizetype i = 0; i < aKeys.size(); ++i)
+    {
+        marks << "?";
+    }
+
+    QString sql = aBaseSql + " WHERE " + keyColumn + " IN (" + marks.join(',') + ")";
+    QSqlQuery q(aDb);
+    q.setForwardOnly(true);
+    bool ok = q.prepare(sql);
+    if (ok)
+    {
+        foreach (const QString &k, aKeys)
+        {
+            q.addBindValue(k);
+        }
+        ThrottleGuard guard(aDb);
+        ok = q.exec();
+    }
+
+    if (!ok)
+    {
+        lastError = QString("%1 (%2)").arg(sql, q.lastError().text());
+        fallback(QString("batch query failed"));
+        return false;
+    }
+
+    if (!groupRows(q, 0))
+    {
+        fallback(QString("batch query failed, %1").arg(lastError));
+        return false;
+    }
+
+    // keys without rows are remembered as empty results
+    foreach (const QString &k, aKeys)
+    {
+        if (!groups.contains(k))
+        {
+            groups.insert(k, QList<RowSource::Row>());
+        }
+    }
+
+    return true;
+}
+
+//! Count a block call, the SQL is used to count the different calls.
+void AdaptiveBlock::addCall(const QString &aSql, qint64 aNanos)
+{
+    calls++;
+    nanos += aNanos;
+    sqlHashes.insert(qHash(aSql));
+}
+
+BlockStatistic AdaptiveBlock::statistic() const
+{
+    BlockStatistic s;
+
+    s.calls = calls;
+    s.rows = rows;
+    s.distinct = sqlHashes.size();
+    s.nanos = nanos;
+    s.tableRows = tableRows > 0 ? tableRows : last.tableRows;
+
+    return s;
+}
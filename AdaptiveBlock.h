@@ -0,0 +1,74 @@
+#ifndef ADAPTIVEBLOCK_H
+#define ADAPTIVEBLOCK_H
+
+#include "QuerySetEntry.h"
+#include "RowSource.h"
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+//! A nested SQL block which is called for every row of the outer block.
+//! The statistics of the last run select how the rows are read: one query
+//! per call, batches of keys fetched with an IN list, the whole table
+//! preloaded once or the results cached by their SQL. The batch and the
+//! preload strategy need a query ending with WHERE <column> = ${<var>}.
+class AdaptiveBlock
+{
+public:
+    enum Strategy { PerRow, InList, Preload, Cache };
+
+    AdaptiveBlock(const QString &aName, const QString &aSql, const BlockStatistic &aLast);
+
+    QString getName() const { return name; }
+    void choose(const QString &aForced);
+    void fallback(const QString &aReason);
+    Strategy getStrategy() const { return strategy; }
+    QString getReason() const { return reason; }
+    static QString strategyName(Strategy s);
+    static bool splitKeyFilter(const QString &aSql, QString &aBaseSql, QString &aColumn, QString &aVariable);
+
+    QString getBaseSql() const { return baseSql; }
+    QString getKeyVariable() const { return keyVariable; }
+    qint32 getBatchSize() const { return batchSize; }
+    bool isLoaded() const { return loaded; }
+    QString getLastError() const { return lastError; }
+
+    RowSource *cachedRows(const QString &aKey);
+    RowSource *cacheQuery(QSqlQuery &aQuery, const QString &aSql);
+    bool preload(QSqlDatabase aDb, const QString &aBaseSql);
+    bool fetchKeys(QSqlDatabase aDb, const QString &aBaseSql, const QStringList &aKeys);
+
+    void addCall(const QString &aSql, qint64 aNanos);
+    void addRows(quint64 aRows) { rows += aRows; }
+    BlockStatistic statistic() const;
+
+private:
+    bool groupRows(QSqlQuery &aQuery, qint32 aMaxRows);
+
+    QString name;
+    QString baseSql;        // the SQL up to the WHERE of the key filter
+    QString keyColumn;      // the column of the key filter
+    QString keyField;       // the result column with the key value
+    QString keyVariable;    // the variable of the key filter
+    BlockStatistic last;
+    Strategy strategy;
+    QString reason;
+    qint32 batchSize;
+    bool loaded;
+    QString lastError;
+
+    QHash<QString, QList<RowSource::Row> > groups;
+    quint64 cachedRowCount;
+
+    quint64 calls;
+    quint64 rows;
+    quint64 nanos;
+    quint64 tableRows;
+    QSet<size_t> sqlHashes;
+};
+
+#endif // ADAPTIVEBLOCK_H
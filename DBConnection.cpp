@@ -1,7 +1,12 @@
 #include "DBConnection.h"
+#include "FileTable.h"
 
 #include <QCoreApplication>
 #include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QUrl>
 #include <QMessageBox>
 #include <QInputDialog>
 #include <QStringBuilder>
@@ -18,6 +23,15 @@ DbConnection::DbConnection(QObject *parentObj) :
     dbEncoding("ISO-8859-1"), // the internal name for Latin1
     dbName(""),
     dbOptions(""),
+    maxQueriesPerSecond(0.0),
+    maxConcurrentQueries(0),
+    throttle(),
+    replicas(""),
+    router(),
+    sqliteProfile(""),
+    sqliteMemoryCopy(false),
+    fileTables(""),
+    basePath(""),
     tablePrefix(""),
     host(""),
     username(""),
@@ -29,7 +43,7 @@ DbConnection::DbConnection(QObject *parentObj) :
 
 DbConnection::~DbConnection()
 {
-
+    QueryThrottle::detach(QString(QSqlDatabase::defaultConnection), &throttle);
 }
 
 void DbConnection::readXmlNode(const QDomNode &aNode)
@@ -45,6 +59,12 @@ void DbConnection::readXmlNode(const QDomNode &aNode)
         if(ce == "DBNAME") { dbName = te; }
         if(ce == "DBENCODING") { dbEncoding = te; }
         if(ce == "DBOPTIONS") { dbOptions = te; }
+        if(ce == "MAXQUERIESPERSECOND") { maxQueriesPerSecond = te.toDouble(); }
+        if(ce == "MAXCONCURRENTQUERIES") { maxConcurrentQueries = te.toInt(); }
+        if(ce == "REPLICAS") { setReplicas(te); }
+        if(ce == "SQLITEPROFILE") { sqliteProfile = te.trimmed(); }
+        if(ce == "SQLITEMEMORYCOPY") { sqliteMemoryCopy = (te == "yes"); }
+        if(ce == "FILETABLES") { fileTables = te.trimmed(); }
         if(ce == "PREFIX") { tablePrefix = te; }
         if(ce == "HOST")   { host = te; }
         if(ce == "USER")   { username = te; }
@@ -67,6 +87,12 @@ void DbConnection::writeXmlNode(QXmlStreamWriter &aStream)
     aStream.writeTextElement("port", QString("%1").arg(port));
     aStream.writeTextElement("dbname", dbName);
     aStream.writeTextElement("dboptions", dbOptions);
+    aStream.writeTextElement("maxQueriesPerSecond", QString("%1").arg(maxQueriesPerSecond));
+    aStream.writeTextElement("maxConcurrentQueries", QString("%1").arg(maxConcurrentQueries));
+    aStream.writeTextElement("replicas", replicas);
+    aStream.writeTextElement("sqliteProfile", sqliteProfile);
+    aStream.writeTextElement("sqliteMemoryCopy", sqliteMemoryCopy ? "yes" : "no");
+    aStream.writeTextElement("fileTables", fileTables);
     aStream.writeTextElement("user", username);
     if(passwordSave)
     {
@@ -101,6 +127,37 @@ void DbConnection::setDbOptions(const QString &value)
     dbOptions = value;
 }
 
+void DbConnection::setMaxQueriesPerSecond(double value)
+{
+    maxQueriesPerSecond = value;
+}
+
+void DbConnection::setMaxConcurrentQueries(qint32 value)
+{
+    maxConcurrentQueries = value;
+}
+
+void DbConnection::setReplicas(const QString &value)
+{
+    replicas = value;
+    router.setEndpoints(value);
+}
+
+void DbConnection::setSqliteProfile(const QString &value)
+{
+    sqliteProfile = value;
+}
+
+void DbConnection::setSqliteMemoryCopy(const bool value)
+{
+    sqliteMemoryCopy = value;
+}
+
+void DbConnection::setFileTables(const QString &value)
+{
+    fileTables = value;
+}
+
 void DbConnection::setTablePrefix(const QString &value)
 {
     tablePrefix = value;
@@ -155,20 +212,24 @@ QString DbConnection::getConnectionName() const
     return vDbName;
 }
 
-bool DbConnection::connectDatabase()
+//! Connect the database using the given Qt connection name, the default
+//! connection is used by the reports, other names for additional databases.
+//! Read only connections use the replicas if there are some.
+bool DbConnection::connectDatabase(const QString &aConnection, bool aReadOnly)
 {
-    QSqlDatabase db = QSqlDatabase::database();
+    QSqlDatabase db = QSqlDatabase::database(aConnection, false);
 
-    qDebug() << "connect database";
+    qDebug() << "connect database" << aConnection;
 
-    if(!QSqlDatabase::contains() || db.driverName() != dbType)
+    if(!QSqlDatabase::contains(aConnection) || db.driverName() != dbType)
     {
-        if(QSqlDatabase::contains())
+        if(QSqlDatabase::contains(aConnection))
         {
-            QSqlDatabase::removeDatabase(db.connectionName());
+            db = QSqlDatabase();
+            QSqlDatabase::removeDatabase(aConnection);
         }
         qDebug() << "adding database type connection " << dbType;
-        db = QSqlDatabase::addDatabase(dbType);
+        db = QSqlDatabase::addDatabase(dbType, aConnection);
     }
 
     if(!username.isEmpty() && !passwordSave && password.isEmpty())
@@ -182,12 +243,25 @@ bool DbConnection::connectDatabase()
             setPassword(pwd);
         }
     }
-    if(!dbName.isEmpty()) db.setDatabaseName(getConnectionName());
+    // the SQLite profile and the memory copy are only used for connections without changes
+    bool sqliteReadOnly = aReadOnly && "QSQLITE" == dbType;
+    bool profile = sqliteReadOnly && !sqliteProfile.isEmpty() && "NO" != sqliteProfile.toUpper();
+    if (profile && sqliteProfile.contains("analyze", Qt::CaseInsensitive))
+    {
+        analyzeSqlite(getConnectionName());
+    }
+    // with the memory copy all connections share an in-memory copy of the file
+    bool memory = sqliteReadOnly && sqliteMemoryCopy;
+
+    if(!dbName.isEmpty()) db.setDatabaseName(sqliteFileName(getConnectionName(), profile));
+    if(memory) db.setDatabaseName(QString("file:sqlreport-%1?mode=memory&cache=shared")
+                                  .arg(QString(QUrl::toPercentEncoding(name))));
     if(!host.isEmpty()) db.setHostName(host);
     if(port != 0) db.setPort(port);
     if(!username.isEmpty()) db.setUserName(username);
     if(!password.isEmpty()) db.setPassword(password);
 
+    db.setConnectOptions();
     if (!dbOptions.isEmpty()) {
         QStringList ol = dbOptions.split(QLatin1Char('|'), Qt::SkipEmptyParts);
         foreach(QString o, ol)
@@ -195,24 +269,302 @@ bool DbConnection::connectDatabase()
             db.setConnectOptions(o);
         }
     }
+    if (profile || memory)
+    {
+        // the memory copy is written once, query_only of the profile protects it afterwards
+        QString o = db.connectOptions();
+        db.setConnectOptions((o.isEmpty() ? o : o + ";") + "QSQLITE_OPEN_URI"
+                             + (memory ? "" : ";QSQLITE_OPEN_READONLY"));
+    }
 
-    bool ok = db.open();
+    bool ok = aReadOnly && !memory && router.isActive() && openReplica(db, aConnection, profile);
+    if(!ok)
+    {
+        ok = db.open();
+    }
     if(ok != true)
     {
         showDbError();
     }
+    else
+    {
+        // the temporary tables are created before query_only is set
+        ok = (!memory || cloneSqlite(db, getConnectionName())) && loadFileTables(db);
+        if (profile)
+        {
+            applySqliteProfile(db);
+        }
+    }
+
+    // all queries at this connection use the limits of this database
+    throttle.configure(maxQueriesPerSecond, maxConcurrentQueries);
+    QueryThrottle::attach(db.connectionName(), &throttle);
 
     return ok;
 }
 
-void DbConnection::closeDatabase() const
+//! Open the connection at the replica with the fewest outstanding connections,
+//! a replica which can't be opened is ejected and the next one is tried.
+//! \return false if no replica is available, the primary settings are restored
+bool DbConnection::openReplica(QSqlDatabase &db, const QString &aConnection, bool aProfile)
 {
-    qDebug() << "close database";
-    QSqlDatabase db = QSqlDatabase::database();
+    for (qint32 i = 0; i < router.size(); ++i)
+    {
+        QString endpoint = router.endpoint(router.acquire(aConnection));
+        if ("QSQLITE" == dbType)
+        {
+            // the replicas of a SQLite database are copies of the file
+            db.setDatabaseName(sqliteFileName(endpoint, aProfile));
+        }
+        else
+        {
+            db.setHostName(endpoint.section(':', 0, 0));
+            if (!endpoint.section(':', 1).isEmpty()) db.setPort(endpoint.section(':', 1).toInt());
+        }
+
+        if (db.open())
+        {
+            router.markHealthy(aConnection);
+            logger->infoMsg(tr("connection %1 uses the replica %2").arg(name, endpoint));
+            return true;
+        }
+        logger->warnMsg(tr("replica %1 ejected (%2)").arg(endpoint, db.lastError().text()));
+        router.release(aConnection, true);
+    }
+
+    logger->warnMsg(tr("no replica of %1 is available, using the primary database").arg(name));
+    if(!dbName.isEmpty()) db.setDatabaseName(sqliteFileName(getConnectionName(), aProfile));
+    db.setHostName(host);
+    db.setPort(0 != port ? static_cast<int>(port) : -1);
+
+    return false;
+}
+
+//! The SQLite profile opens the file as URI, read only or with immutable=1
+//! if the file isn't changed while the report runs.
+QString DbConnection::sqliteFileName(const QString &aFile, bool aProfile) const
+{
+    if (!aProfile || aFile.startsWith("file:") || aFile.startsWith(':'))
+    {
+        return aFile;
+    }
+
+    bool immutable = sqliteProfile.contains("immutable", Qt::CaseInsensitive);
+    return QUrl::fromLocalFile(QFileInfo(aFile).absoluteFilePath()).toString(QUrl::FullyEncoded)
+            + (immutable ? "?immutable=1" : "?mode=ro");
+}
+
+//! Settings for read heavy reports: the file is memory mapped (256MB), the
+//! page cache has 64MB, temporary tables and sort buffers are kept in memory
+//! and the connection can't change the database.
+void DbConnection::applySqliteProfile(QSqlDatabase &db)
+{
+    QSqlQuery q(db);
+    QStringList pragmas;
+    pragmas << "PRAGMA mmap_size=268435456"
+            << "PRAGMA cache_size=-65536"
+            << "PRAGMA temp_store=MEMORY"
+            << "PRAGMA query_only=ON";
+    foreach (const QString &p, pragmas)
+    {
+        if (!q.exec(p))
+        {
+            logger->warnMsg(tr("SQLite profile '%1' (%2)").arg(p, q.lastError().text()));
+        }
+    }
+    logger->infoMsg(tr("connection %1 uses the SQLite profile '%2'").arg(name, sqliteProfile));
+}
+
+//! Create the optimizer statistics of the file, if they don't exist.
+void DbConnection::analyzeSqlite(const QString &aFile)
+{
+    QString cn("sqlreport-analyze");
+    {
+        QSqlDatabase adb = QSqlDatabase::addDatabase("QSQLITE", cn);
+        adb.setDatabaseName(aFile);
+        if (adb.open())
+        {
+            QSqlQuery q(adb);
+            if (q.exec("SELECT 1 FROM sqlite_master WHERE name = 'sqlite_stat1'") && !q.next())
+            {
+                QElapsedTimer t;
+                t.start();
+                if (q.exec("ANALYZE"))
+                {
+                    logger->infoMsg(tr("ANALYZE of %1 in %2 ms").arg(aFile).arg(t.elapsed()));
+                }
+                else
+                {
+                    logger->warnMsg(tr("ANALYZE of %1 failed (%2)").arg(aFile, q.lastError().text()));
+                }
+            }
+            q.finish();
+            adb.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(cn);
+}
+
+//! Copy the SQLite file into the shared in-memory database of the connection,
+//! if it is empty. The backup API would need sqlite3 as link dependency for
+//! the handle of the Qt driver, instead the file is attached and the schema
+//! and the rows are copied table by table with SQL in one transaction. The indexes, views and triggers are created after the rows,
+//! existing optimizer statistics are copied too.
+//! \return false if the copy fails
+bool DbConnection::cloneSqlite(QSqlDatabase &db, const QString &aFile)
+{
+    QSqlQuery q(db);
+    if (q.exec("SELECT count(*) FROM sqlite_master") && q.next() && q.value(0).toInt() > 0)
+    {
+        // another connection of the run has copied the file already
+        logger->infoMsg(tr("connection %1 uses the memory copy of %2").arg(name, aFile));
+        return true;
+    }
+
+    QElapsedTimer t;
+    t.start();
+    QString source = sqliteFileName(aFile, true);
+    if (!q.exec(QString("ATTACH DATABASE '%1' AS sr_source").arg(source.replace("'", "''"))))
+    {
+        logger->errorMsg(tr("copy of %1 into memory (%2)").arg(aFile, q.lastError().text()));
+        return false;
+    }
+
+    QList<QStringList> objects;
+    bool hasStatistics = false;
+    bool ok = q.exec("SELECT type, name, sql FROM sr_source.sqlite_master WHERE sql IS NOT NULL"
+                     " ORDER BY CASE type WHEN 'table' THEN 0 WHEN 'index' THEN 1 ELSE 2 END");
+    while (ok && q.next())
+    {
+        if (q.value(1).toString().startsWith("sqlite_"))
+        {
+            hasStatistics = hasStatistics || "sqlite_stat1" == q.value(1).toString();
+        }
+        else
+        {
+            objects << (QStringList() << q.value(0).toString() << q.value(1).toString() << q.value(2).toString());
+        }
+    }
+
+    qint32 tableCount = 0;
+    ok = ok && db.transaction();
+    foreach (const QStringList &o, objects)
+    {
+        if (!ok) break;
+        if (o.at(2).startsWith("CREATE VIRTUAL", Qt::CaseInsensitive))
+        {
+            logger->warnMsg(tr("virtual table %1 isn't copied into memory").arg(o.at(1)));
+            continue;
+        }
+        ok = q.exec(o.at(2));
+        if (ok && "table" == o.at(0))
+        {
+            // generated columns (hidden 2 and 3) can't be inserted, they are computed again
+            QString table = QString(o.at(1)).replace("\"", "\"\"");
+            QStringList columns;
+            ok = q.exec(QString("PRAGMA sr_source.table_xinfo(\"%1\")").arg(table));
+            while (ok && q.next())
+            {
+                if (q.value("hidden").toInt() < 2)
+                {
+                    columns << "\"" + q.value("name").toString().replace("\"", "\"\"") + "\"";
+                }
+            }
+            ok = ok && q.exec(QString("INSERT INTO main.\"%1\" (%2) SELECT %2 FROM sr_source.\"%1\"")
+                              .arg(table, columns.join(", ")));
+            tableCount++;
+        }
+    }
+    if (ok && hasStatistics)
+    {
+        // ANALYZE of the schema table creates an empty sqlite_stat1
+        ok = q.exec("ANALYZE sqlite_master")
+                && q.exec("INSERT INTO main.sqlite_stat1 SELECT * FROM sr_source.sqlite_stat1")
+                && q.exec("ANALYZE sqlite_master");
+    }
+    QString errText = q.lastError().text();
+    if (ok && !db.commit())
+    {
+        ok = false;
+        errText = db.lastError().text();
+    }
+    else if (!ok)
+    {
+        db.rollback();
+    }
+    q.exec("DETACH DATABASE sr_source");
+
+    if (!ok)
+    {
+        logger->errorMsg(tr("copy of %1 into memory (%2)").arg(aFile, errText));
+        return false;
+    }
+
+    qint64 bytes = 0;
+    if (q.exec("PRAGMA page_count") && q.next())
+    {
+        bytes = q.value(0).toLongLong();
+        if (q.exec("PRAGMA page_size") && q.next()) bytes *= q.value(0).toLongLong();
+    }
+    logger->infoMsg(tr("copied %1 with %2 tables into memory in %3 ms, using %4 MB")
+                    .arg(aFile).arg(tableCount).arg(t.elapsed())
+                    .arg(static_cast<double>(bytes) / (1024.0 * 1024.0), 0, 'f', 1));
+
+    return true;
+}
+
+//! Load the files name=file[,indexcolumn] separated by semicolon as temporary
+//! tables of a QSQLITE connection, relative file names are resolved against
+//! the directory of the query set.
+//! \return false if a file can't be loaded
+bool DbConnection::loadFileTables(QSqlDatabase &db)
+{
+    if (fileTables.isEmpty())
+    {
+        return true;
+    }
+    if ("QSQLITE" != dbType)
+    {
+        logger->warnMsg(tr("file tables of %1 are ignored, they need a QSQLITE connection").arg(name));
+        return true;
+    }
+
+    foreach (const QString &entry, fileTables.split(';', Qt::SkipEmptyParts))
+    {
+        QString tableName = entry.section('=', 0, 0).trimmed();
+        QString file = entry.section('=', 1).section(',', 0, 0).trimmed();
+        QString index = entry.section('=', 1).section(',', 1).trimmed();
+        if (tableName.isEmpty() || file.isEmpty())
+        {
+            logger->errorMsg(tr("file table '%1' needs the form name=file[,indexcolumn]").arg(entry));
+            return false;
+        }
+
+        FileTable ft(tableName, QDir(basePath).absoluteFilePath(file), index);
+        if (!ft.load(db))
+        {
+            logger->errorMsg(tr("file table %1: %2").arg(tableName, ft.getLastError()));
+            return false;
+        }
+        logger->infoMsg(ft.statistics());
+    }
+
+    return true;
+}
+
+void DbConnection::closeDatabase(const QString &aConnection)
+{
+    qDebug() << "close database" << aConnection;
+    QSqlDatabase db = QSqlDatabase::database(aConnection, false);
     if(db.isOpen())
     {
         db.close();
     }
+    if (router.isActive())
+    {
+        router.release(aConnection, false);
+        if (nullptr != logger) logger->debugMsg(tr("replicas of %1: %2").arg(name, router.statistics()));
+    }
 }
 
 QString DbConnection::getFieldString(const QSqlField field) const
@@ -8,6 +8,8 @@
 #include <QtXml/QDomDocument>
 #include <QtCore/QXmlStreamWriter>
 #include "QTreeReporter.h"
+#include "QueryThrottle.h"
+#include "ReplicaRouter.h"
 #include "logmessage.h"
 
 //! This class holds the information for a database connection and has some methods to
@@ -26,8 +28,9 @@ public:
 
 	void showDbError();
 	QString getConnectionName() const;
-	bool connectDatabase();
-	void closeDatabase() const;
+	bool connectDatabase(const QString &aConnection = QString(QSqlDatabase::defaultConnection),
+						 bool aReadOnly = false);
+	void closeDatabase(const QString &aConnection = QString(QSqlDatabase::defaultConnection));
     void showTableList(QSql::TableType aType, QString aHead, bool withFk, QTreeReporter *treeReporter) const;
     void showDatabaseTables(QTreeReporter *tr, bool withFk) const;
 
@@ -49,6 +52,26 @@ public:
     QString getDbOptions() const {return dbOptions; }
     void setDbOptions(const QString &value);
 
+    double getMaxQueriesPerSecond() const {return maxQueriesPerSecond; }
+    void setMaxQueriesPerSecond(double value);
+
+    qint32 getMaxConcurrentQueries() const {return maxConcurrentQueries; }
+    void setMaxConcurrentQueries(qint32 value);
+
+    QueryThrottle *getThrottle() {return &throttle; }
+
+    QString getReplicas() const {return replicas; }
+    void setReplicas(const QString &value);
+
+    QString getSqliteProfile() const {return sqliteProfile; }
+    void setSqliteProfile(const QString &value);
+
+    bool getSqliteMemoryCopy() const {return sqliteMemoryCopy; }
+    void setSqliteMemoryCopy(const bool value);
+
+    QString getFileTables() const {return fileTables; }
+    void setFileTables(const QString &value);
+
 	QString getTablePrefix() const {return tablePrefix; }
 	void setTablePrefix(const QString &value);
 
@@ -72,6 +95,12 @@ public:
         logger = l;
     }
 
+    //! relative fileTables paths are resolved against this directory
+    void setBasePath(const QString &aPath)
+    {
+        basePath = aPath;
+    }
+
 private:
     LogMessage *logger;
 	QString name;
@@ -79,6 +108,15 @@ private:
     QString dbEncoding;
 	QString dbName;
     QString dbOptions;
+    double maxQueriesPerSecond;
+    qint32 maxConcurrentQueries;
+    QueryThrottle throttle;
+    QString replicas;
+    ReplicaRouter router;
+    QString sqliteProfile;
+    bool sqliteMemoryCopy;
+    QString fileTables;
+    QString basePath;
 	QString tablePrefix;
 	QString host;
 	QString username;
@@ -87,6 +125,12 @@ private:
 	bool passwordSave;
 
     QString getFieldString(const QSqlField field) const;
+    bool openReplica(QSqlDatabase &db, const QString &aConnection, bool aProfile);
+    QString sqliteFileName(const QString &aFile, bool aProfile) const;
+    void applySqliteProfile(QSqlDatabase &db);
+    void analyzeSqlite(const QString &aFile);
+    bool cloneSqlite(QSqlDatabase &db, const QString &aFile);
+    bool loadFileTables(QSqlDatabase &db);
     QStringList getForeignKeyList(QString &tableName) const;
 };
 
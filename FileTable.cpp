@@ -0,0 +1,404 @@
+#include "FileTable.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+//! rows used to choose the column types and rows per execBatch call
+static const qint32 sampleRows = 1000;
+static const qint32 batchRows = 10000;
+
+FileTable::FileTable(const QString &aName, const QString &aFileName, const QString &aIndexColumn)
+    : name(aName),
+      fileName(aFileName),
+      indexColumn(aIndexColumn),
+      lastError(""),
+      data(nullptr),
+      size(0),
+      pos(0),
+      lineNo(0),
+      json(false),
+      delimiter(','),
+      columns(),
+      types(),
+      rowCount(0),
+      loadMs(0)
+{
+}
+
+//! Read the whole file into the temporary table name, an existing table
+//! with this name is replaced.
+//! \return false if the file can't be read or the table can't be created
+bool FileTable::load(QSqlDatabase db)
+{
+    QElapsedTimer t;
+    t.start();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        lastError = QString("can't open %1 (%2)").arg(fileName, file.errorString());
+        return false;
+    }
+
+    // the file is parsed in place, small or special files are read
+    QByteArray content;
+    uchar *mapped = file.size() > 0 ? file.map(0, file.size()) : nullptr;
+    if (nullptr != mapped)
+    {
+        data = reinterpret_cast<const char*>(mapped);
+        size = file.size();
+    }
+    else
+    {
+        content = file.readAll();
+        data = content.constData();
+        size = content.size();
+    }
+    pos = 0;
+    lineNo = 0;
+    if (size >= 3 && 0 == qstrncmp(data, "\xEF\xBB\xBF", 3))
+    {
+        pos = 3;
+    }
+
+    QString lower = fileName.toLower();
+    json = lower.endsWith(".json") || lower.endsWith(".jsonl") || lower.endsWith(".ndjson");
+    readHeader();
+
+    QList<QStringList> sample;
+    QStringList fields;
+    while (sample.size() < sampleRows && nextRecord(fields))
+    {
+        sample << fields;
+    }
+    if (!lastError.isEmpty())
+    {
+        return false;
+    }
+    if (columns.isEmpty())
+    {
+        lastError = QString("%1 has no columns").arg(fileName);
+        return false;
+    }
+    detectTypes(sample);
+
+    bool ok = createTable(db) && insertRows(db, sample);
+    if (ok && !indexColumn.isEmpty())
+    {
+        QSqlQuery q(db);
+        if (!q.exec(QString("CREATE INDEX temp.%1 ON %2 (%3)")
+                    .arg(quoted("idx_" + name + "_" + indexColumn), quoted(name), quoted(indexColumn))))
+        {
+            lastError = QString("index on %1 (%2)").arg(indexColumn, q.lastError().text());
+            ok = false;
+        }
+    }
+
+    if (nullptr != mapped)
+    {
+        file.unmap(mapped);
+    }
+    data = nullptr;
+    loadMs = t.elapsed();
+
+    return ok;
+}
+
+//! The CSV header names the columns, the delimiter is the most frequent
+//! of comma, semicolon and tab at the first line. The columns of a JSON
+//! file are the keys of the first object, an invalid first line is
+//! reported by nextJsonRecord.
+void FileTable::readHeader()
+{
+    columns.clear();
+    if (json)
+    {
+        qsizetype start = pos;
+        QByteArray line;
+        while (pos < size && line.isEmpty())
+        {
+            qsizetype s = pos;
+            while (pos < size && '\n' != data[pos]) ++pos;
+            line = QByteArray::fromRawData(data + s, pos - s).trimmed();
+            if (pos < size) ++pos;
+        }
+        columns = QJsonDocument::fromJson(line).object().keys();
+        pos = start;
+        return;
+    }
+
+    qsizetype lineEnd = pos;
+    while (lineEnd < size && '\n' != data[lineEnd]) ++lineEnd;
+    qint32 best = 0;
+    foreach (char c, QByteArray(",;\t"))
+    {
+        qint32 cnt = static_cast<qint32>(QByteArray::fromRawData(data + pos, lineEnd - pos).count(c));
+        if (cnt > best)
+        {
+            best = cnt;
+            delimiter = c;
+        }
+    }
+
+    QStringList header;
+    nextCsvRecord(header);
+    for (qint32 i = 0; i < header.size(); ++i)
+    {
+        QString c = header.at(i).trimmed();
+        if (c.isEmpty()) c = QString("column%1").arg(i + 1);
+        while (columns.contains(c, Qt::CaseInsensitive)) c += QString("_%1").arg(i + 1);
+        columns << c;
+    }
+}
+
+bool FileTable::nextRecord(QStringList &fields)
+{
+    return json ? nextJsonRecord(fields) : nextCsvRecord(fields);
+}
+
+//! Read the next CSV record, quoted fields can contain delimiters, line
+//! breaks and doubled quotes. Unquoted fields are converted directly from
+//! the mapped file.
+bool FileTable::nextCsvRecord(QStringList &fields)
+{
+    fields.clear();
+
+    // skip empty lines
+    while (pos < size && ('\n' == data[pos] || '\r' == data[pos])) ++pos;
+    if (pos >= size)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        if (pos < size && '"' == data[pos])
+        {
+            QByteArray v;
+            ++pos;
+            while (pos < size)
+            {
+                if ('"' == data[pos])
+                {
+                    if (pos + 1 < size && '"' == data[pos + 1])
+                    {
+                        v += '"';
+                        pos += 2;
+                        continue;
+                    }
+                    ++pos;
+                    break;
+                }
+                qsizetype s = pos;
+                while (pos < size && '"' != data[pos]) ++pos;
+                v.append(data + s, pos - s);
+            }
+            fields << QString::fromUtf8(v);
+            while (pos < size && delimiter != data[pos] && '\n' != data[pos]) ++pos;
+        }
+        else
+        {
+            qsizetype s = pos;
+            while (pos < size && delimiter != data[pos] && '\n' != data[pos]) ++pos;
+            qsizetype e = pos;
+            if (e > s && '\r' == data[e - 1]) --e;
+            fields << QString::fromUtf8(data + s, e - s);
+        }
+
+        if (pos < size && delimiter == data[pos])
+        {
+            ++pos;
+            continue;
+        }
+        if (pos < size)
+        {
+            ++pos;      // the line feed
+        }
+        return true;
+    }
+}
+
+//! Read the next JSON object of a JSON lines file, the values are ordered
+//! like the columns, nested values are stored as compact JSON text.
+//! \return false at the end of the file or with lastError set at a line
+//!         that is no JSON object
+bool FileTable::nextJsonRecord(QStringList &fields)
+{
+    fields.clear();
+    while (pos < size)
+    {
+        qsizetype s = pos;
+        while (pos < size && '\n' != data[pos]) ++pos;
+        qsizetype e = pos;
+        if (pos < size) ++pos;
+        lineNo++;
+
+        QByteArray line = QByteArray::fromRawData(data + s, e - s).trimmed();
+        if (line.isEmpty())
+        {
+            continue;
+        }
+        QJsonParseError parseError;
+        QJsonDocument doc = QJsonDocument::fromJson(line, &parseError);
+        if (!doc.isObject())
+        {
+            lastError = QString("line %1 of %2 is no JSON object (%3)")
+                    .arg(lineNo).arg(fileName)
+                    .arg(QJsonParseError::NoError != parseError.error ? parseError.errorString() : QString("not an object"));
+            return false;
+        }
+        QJsonObject o = doc.object();
+        foreach (const QString &c, columns)
+        {
+            QJsonValue v = o.value(c);
+            if (v.isObject())     fields << QString::fromUtf8(QJsonDocument(v.toObject()).toJson(QJsonDocument::Compact));
+            else if (v.isArray()) fields << QString::fromUtf8(QJsonDocument(v.toArray()).toJson(QJsonDocument::Compact));
+            else if (v.isBool())  fields << (v.toBool() ? "1" : "0");
+            else if (v.isDouble()) fields << QString::number(v.toDouble(), 'g', 17);
+            else if (v.isString()) fields << v.toString();
+            else                  fields << QString();
+        }
+        return true;
+    }
+
+    return false;
+}
+
+//! A column is INTEGER or REAL if all sampled values are numbers, numbers
+//! with leading zeros like codes stay TEXT.
+void FileTable::detectTypes(const QList<QStringList> &aSample)
+{
+    types.clear();
+    for (qint32 c = 0; c < columns.size(); ++c)
+    {
+        QString type("INTEGER");
+        bool any = false;
+        foreach (const QStringList &r, aSample)
+        {
+            QString v = c < r.size() ? r.at(c) : QString();
+            if (v.isEmpty()) continue;
+            any = true;
+            bool isInt = false, isReal = false;
+            v.toLongLong(&isInt);
+            v.toDouble(&isReal);
+            if (v.size() > 1 && '0' == v.at(0) && '.' != v.at(1))
+            {
+                isInt = isReal = false;
+            }
+            if ("INTEGER" == type && !isInt)
+            {
+                type = "REAL";
+            }
+            if ("REAL" == type && !isReal)
+            {
+                type = "TEXT";
+                break;
+            }
+        }
+        types << (any ? type : QString("TEXT"));
+    }
+}
+
+bool FileTable::createTable(QSqlDatabase db)
+{
+    QStringList defs;
+    for (qint32 i = 0; i < columns.size(); ++i)
+    {
+        defs << quoted(columns.at(i)) + " " + types.at(i);
+    }
+
+    QSqlQuery q(db);
+    if (!q.exec(QString("DROP TABLE IF EXISTS temp.%1").arg(quoted(name)))
+            || !q.exec(QString("CREATE TEMP TABLE %1 (%2)").arg(quoted(name), defs.join(", "))))
+    {
+        lastError = QString("create table %1 (%2)").arg(name, q.lastError().text());
+        return false;
+    }
+
+    return true;
+}
+
+//! Insert the sampled rows and all following rows in batches, empty
+//! values are NULL and the column affinity converts the numbers.
+bool FileTable::insertRows(QSqlDatabase db, const QList<QStringList> &aSample)
+{
+    QStringList marks;
+    for (qint32 i = 0; i < columns.size(); ++i) marks << "?";
+
+    db.transaction();
+    QSqlQuery q(db);
+    if (!q.prepare(QString("INSERT INTO temp.%1 VALUES (%2)").arg(quoted(name), marks.join(','))))
+    {
+        lastError = QString("insert into %1 (%2)").arg(name, q.lastError().text());
+        db.rollback();
+        return false;
+    }
+
+    QList<QVariantList> batch;
+    for (qint32 i = 0; i < columns.size(); ++i) batch << QVariantList();
+    qint32 batchSize = 0;
+    qsizetype sampleIdx = 0;
+    QStringList fields;
+    bool more = true;
+    while (more)
+    {
+        if (sampleIdx < aSample.size())
+        {
+            fields = aSample.at(sampleIdx++);
+        }
+        else
+        {
+            more = nextRecord(fields);
+            if (!more && !lastError.isEmpty())
+            {
+                db.rollback();
+                return false;
+            }
+        }
+        if (more)
+        {
+            for (qint32 i = 0; i < columns.size(); ++i)
+            {
+                QString v = i < fields.size() ? fields.at(i) : QString();
+                batch[i] << (v.isEmpty() ? QVariant() : QVariant(v));
+            }
+            batchSize++;
+            rowCount++;
+        }
+
+        if (batchSize > 0 && (batchSize >= batchRows || !more))
+        {
+            for (qint32 i = 0; i < columns.size(); ++i)
+            {
+                q.addBindValue(batch.at(i));
+                batch[i].clear();
+            }
+            batchSize = 0;
+            if (!q.execBatch())
+            {
+                lastError = QString("insert into %1 (%2)").arg(name, q.lastError().text());
+                db.rollback();
+                return false;
+            }
+        }
+    }
+
+    return db.commit();
+}
+
+QString FileTable::quoted(const QString &aName)
+{
+    return "\"" + QString(aName).replace('"', "\"\"") + "\"";
+}
+
+QString FileTable::statistics() const
+{
+    return QString("file %1 loaded as table %2 with %3 rows and %4 columns in %5 ms")
+            .arg(fileName, name).arg(rowCount).arg(columns.size()).arg(loadMs);
+}
@@ -0,0 +1,55 @@
+#ifndef FILETABLE_H
+#define FILETABLE_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVariantList>
+#include <QtSql/QSqlDatabase>
+
+//! A local CSV or JSON lines file loaded into a temporary table of a SQLite
+//! connection, so reports can join it without an import step. The file is
+//! memory mapped and parsed in place, the column types are chosen from the
+//! first rows and all rows are inserted with execBatch in one transaction.
+//! An optional index is created on one column after loading. A JSON lines
+//! file fails to load at the first line that is no JSON object.
+class FileTable
+{
+public:
+    FileTable(const QString &aName, const QString &aFileName, const QString &aIndexColumn);
+
+    bool load(QSqlDatabase db);
+
+    QString getName() const { return name; }
+    QString getLastError() const { return lastError; }
+    QString statistics() const;
+
+private:
+    bool nextRecord(QStringList &fields);
+    bool nextCsvRecord(QStringList &fields);
+    bool nextJsonRecord(QStringList &fields);
+    void readHeader();
+    void detectTypes(const QList<QStringList> &aSample);
+    bool createTable(QSqlDatabase db);
+    bool insertRows(QSqlDatabase db, const QList<QStringList> &aSample);
+    static QString quoted(const QString &aName);
+
+    QString name;
+    QString fileName;
+    QString indexColumn;
+    QString lastError;
+
+    const char *data;
+    qsizetype size;
+    qsizetype pos;
+    qint64 lineNo;
+    bool json;
+    char delimiter;
+
+    QStringList columns;
+    QStringList types;
+    quint64 rowCount;
+    qint64 loadMs;
+};
+
+#endif // FILETABLE_H
@@ -0,0 +1,164 @@
+#include "LookupTable.h"
+#include "QueryThrottle.h"
+
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlRecord>
+
+//! \param aSql is the query for the whole table, the key column must be part of the result
+//! \param aMaxRows the maximum number of rows kept in memory
+LookupTable::LookupTable(QSqlDatabase aDb, const QString &aName, const QString &aSql,
+                         const QString &aKey, qint32 aMaxRows)
+    : db(aDb),
+      name(aName),
+      sql(aSql),
+      key(aKey),
+      maxRows(aMaxRows),
+      preloaded(false),
+      loaded(false),
+      lastError(""),
+      columns(),
+      rows(),
+      rowQuery(),
+      hits(0),
+      misses(0),
+      queries(0)
+{
+}
+
+//! Read the table into the hash index, stop reading if the size cap
+//! is reached and use queries for every key.
+//! \return false if the query fails
+bool LookupTable::load()
+{
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    bool ok = false;
+    {
+        ThrottleGuard guard(db);
+        ok = q.exec(sql);
+    }
+    if (!ok)
+    {
+        lastError = QString("%1 (%2)").arg(sql, q.lastError().text());
+        return false;
+    }
+
+    QSqlRecord rec = q.record();
+    for (int i = 0; i < rec.count(); ++i)
+    {
+        columns.insert(rec.fieldName(i).toUpper(), i);
+    }
+    qint32 keyIndex = columns.value(key.toUpper(), -1);
+    if (keyIndex < 0)
+    {
+        lastError = QString("key column '%1' isn't part of the result").arg(key);
+        return false;
+    }
+
+    qint32 numCols = rec.count();
+    while (q.next())
+    {
+        if (rows.size() >= maxRows)
+        {
+            // too large, the rows are queried on demand
+            rows.clear();
+            q.finish();
+            loaded = prepareRowQuery();
+            return loaded;
+        }
+
+        QVariantList values;
+        values.reserve(numCols);
+        for (qint32 i = 0; i < numCols; ++i)
+        {
+            values << q.value(i);
+        }
+        rows.insert(values.at(keyIndex).toString(), values);
+    }
+
+    preloaded = true;
+    loaded = true;
+    return true;
+}
+
+bool LookupTable::prepareRowQuery()
+{
+    rowQuery = QSqlQuery(db);
+    rowQuery.setForwardOnly(true);
+    QString rowSql = "SELECT * FROM (" + sql + ") sr_lookup WHERE " + key + " = :key";
+    if (!rowQuery.prepare(rowSql))
+    {
+        lastError = QString("%1 (%2)").arg(rowSql, rowQuery.lastError().text());
+        return false;
+    }
+
+    return true;
+}
+
+//! Search the row with the given key and return the value of the column.
+//! The last error belongs to this call only, a wrong column or a failed
+//! query doesn't disturb the following lookups.
+//! \return false if there is no such row or column
+bool LookupTable::lookup(const QString &aKey, const QString &aColumn, QVariant &aValue)
+{
+    if (!loaded)
+    {
+        // the load error is kept
+        return false;
+    }
+
+    lastError.clear();
+    qint32 col = columns.value(aColumn.toUpper(), -1);
+    if (col < 0)
+    {
+        lastError = QString("column '%1' isn't part of the lookup table").arg(aColumn);
+        return false;
+    }
+
+    if (preloaded)
+    {
+        auto it = rows.constFind(aKey);
+        if (it == rows.constEnd())
+        {
+            misses++;
+            return false;
+        }
+        hits++;
+        aValue = it.value().at(col);
+        return true;
+    }
+
+    queries++;
+    rowQuery.bindValue(":key", aKey);
+    bool ok = false;
+    {
+        ThrottleGuard guard(db);
+        ok = rowQuery.exec();
+    }
+    if (!ok)
+    {
+        lastError = QString("lookup of '%1' (%2)").arg(aKey, rowQuery.lastError().text());
+        return false;
+    }
+
+    bool found = rowQuery.next();
+    if (found)
+    {
+        aValue = rowQuery.value(col);
+    }
+    rowQuery.finish();
+
+    return found;
+}
+
+QString LookupTable::statistics() const
+{
+    if (preloaded)
+    {
+        return QString("lookup %1 with %2 preloaded rows: %3 hits, %4 misses")
+                .arg(name).arg(rows.size()).arg(hits).arg(misses);
+    }
+
+    return QString("lookup %1 exceeds %2 rows: %3 single row queries")
+            .arg(name).arg(maxRows).arg(queries);
+}
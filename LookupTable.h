@@ -0,0 +1,49 @@
+#ifndef LOOKUPTABLE_H
+#define LOOKUPTABLE_H
+
+#include <QHash>
+#include <QString>
+#include <QVariant>
+#include <QVariantList>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+//! A dimension table loaded once per run into a hash index on the key
+//! column, only a single key column is supported. If the table has more
+//! rows than the size cap, the rows are not kept and every lookup executes
+//! a prepared query for the key.
+class LookupTable
+{
+public:
+    LookupTable(QSqlDatabase aDb, const QString &aName, const QString &aSql,
+                const QString &aKey, qint32 aMaxRows);
+
+    bool load();
+    bool lookup(const QString &aKey, const QString &aColumn, QVariant &aValue);
+
+    bool isPreloaded() const { return preloaded; }
+    QString getLastError() const { return lastError; }
+    QString statistics() const;
+
+private:
+    bool prepareRowQuery();
+
+    QSqlDatabase db;
+    QString name;
+    QString sql;
+    QString key;
+    qint32 maxRows;
+    bool preloaded;
+    bool loaded;
+    QString lastError;
+
+    QHash<QString, qint32> columns;
+    QHash<QString, QVariantList> rows;
+    QSqlQuery rowQuery;
+
+    quint64 hits;
+    quint64 misses;
+    quint64 queries;
+};
+
+#endif // LOOKUPTABLE_H
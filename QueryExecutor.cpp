@@ -1,6 +1,8 @@
 #include "QueryExecutor.h"
+#include "SqlDialect.h"
 #include "Utility.h"
 
+#include <QDir>
 #include <QRegularExpression>
 #include <QInputDialog>
 #include <QUrl>
@@ -10,6 +12,11 @@
 #include <QTime>
 #include <QtQml/QJSValue>
 
+#include <functional>
+
+//! the maximum number of rows for every block at a preview run
+static const qint32 previewRows = 10;
+
 QueryExecutor::~QueryExecutor()
 {
 	try
@@ -28,13 +35,36 @@ void QueryExecutor::setPrepareQueriesFlag(bool flag)
 	prepareQueries = flag;
 }
 
+//! A preview run limits every block to the first previewRows rows.
+void QueryExecutor::setPreviewFlag(bool flag)
+{
+	previewRun = flag;
+}
+
+//! The connections used by blocks like ::NAME@connection.
+void QueryExecutor::setConnectionSet(DbConnectionSet *aSet)
+{
+	connectionSet = aSet;
+}
+
 void QueryExecutor::clearStructures()
 {
 	qDeleteAll(templatesMap);
+	qDeleteAll(frames);
+	frames.clear();
+	qDeleteAll(lookupMap);
+	lookupMap.clear();
+	qDeleteAll(adaptiveBlocks);
+	adaptiveBlocks.clear();
+	clientRendered.clear();
+	resultSets.clear();
+	resultSetSql.clear();
     databaseType = "";
 	userInputs.clear();
 	replacements.clear();
 	queriesMap.clear();
+	queryOptionsMap.clear();
+	queryConnectionMap.clear();
 	templatesMap.clear();
 }
 
@@ -161,12 +191,18 @@ void QueryExecutor::replaceLineVariable(const QByteArray vStr, const QStringList
                 }
                 else
                 {
-                    result += vStr.toHex();
+                    appendEncoded(result, rawValue(tmpName, vStr), false);
                 }
 			}
             else if ("BASE64" == vCmd)
             {
-                result += QString(vStr.toBase64());
+                appendEncoded(result, rawValue(tmpName, vStr), true);
+            }
+            else if ("TOFILE" == vCmd && varList.size() > 2)
+            {
+                // the file name pattern uses the simple $name format
+                result += writeValueToFile(rawValue(tmpName, vStr),
+                                           replaceLine(varList.mid(2).join(','), lineCnt, false, true));
             }
 			else if ("BOOL" == vCmd)
 			{
@@ -215,6 +251,32 @@ void QueryExecutor::replaceLineVariable(const QByteArray vStr, const QStringList
 					if (i < (ls-1)) result += "\n";
 				}
 			}
+			else if ("PREV" == vCmd || "NEXT" == vCmd)
+			{
+				// the value of the previous or the next row of the same block
+				QByteArray neighbour;
+				if (neighbourValue(tmpName, "NEXT" == vCmd, neighbour))
+				{
+					result += QString(neighbour);
+				}
+				else if (varList.size() > 2)
+				{
+					result += varList.at(2);
+				}
+			}
+			else if ("LOOKUP" == vCmd && varList.size() > 3)
+			{
+				// resolve the value at a preloaded dimension table
+				QByteArray lookupResult;
+				if (lookupValue(varList.at(2).trimmed(), QString(vStr), varList.at(3).trimmed(), lookupResult))
+				{
+					result += QString(lookupResult);
+				}
+				else if (varList.size() > 4)
+				{
+					result += varList.at(4);
+				}
+			}
 			else if ("CUMULATE" == vCmd)
 			{
 				bool bOk = false;
@@ -273,6 +335,28 @@ void QueryExecutor::replaceLineGlobal(const QStringList &varList, QString &resul
 			}
 			result += getDate(tmpDateFormat);
 		}
+		else if ("__ISFIRST" == tmpName || "__ISLAST" == tmpName)
+		{
+			// the position of the current row at the innermost data block
+			TemplateFrame *f = dataFrame(QString(""));
+			bool b = false;
+			if (nullptr != f && "__ISFIRST" == tmpName)
+			{
+				b = f->firstQueryResult;
+			}
+			else if (nullptr != f)
+			{
+				b = (f->rowLimit > 0 && f->rowCount >= static_cast<quint64>(f->rowLimit))
+					|| f->source->lookahead(1).isEmpty();
+			}
+			result += b ? "true" : "false";
+		}
+		else if ("__WATERMARK" == tmpName)
+		{
+			// the last processed value or the default for the first run
+			QString wm = nullptr != mQSE ? mQSE->getWatermark() : QString("");
+			result += wm.isEmpty() && varList.size() > 1 ? varList.at(1) : wm;
+		}
 		else if ("__UNIQUEID" == tmpName)
 		{
 			result += QString("%1").arg(uniqueId);
@@ -511,16 +595,168 @@ quint32 QueryExecutor::convertToNumber(QString aNumStr, bool &aOk) const
 	return vRes;
 }
 
+//! Search the key at the lookup table, the table is loaded at the first call.
+//! The SQL block is declared as ::NAME,LOOKUP,keycolumn[,maxrows].
+//! \return false if there is no row for the key
+bool QueryExecutor::lookupValue(const QString &aTable, const QString &aKey,
+								const QString &aColumn, QByteArray &aValue)
+{
+	LookupTable *lt = lookupMap.value(aTable, nullptr);
+	QVariant v;
+
+	if (isReplay())
+	{
+		if (!recorder->replayLookup(aTable, aKey, aColumn, v))
+		{
+			return false;
+		}
+	}
+	else if (nullptr == lt)
+	{
+		QStringList options = queryOptionsMap.value(aTable);
+		if (options.size() < 2 || "LOOKUP" != options.at(0) || !queriesMap.contains(aTable))
+		{
+			logger->errorMsg(tr("%1 isn't a lookup block, use ::%1,LOOKUP,<key>").arg(aTable));
+			return false;
+		}
+
+		bool bOk = false;
+		qint32 maxRows = options.size() > 2 ? options.at(2).toInt(&bOk) : 0;
+		if (!bOk || maxRows <= 0) maxRows = 100000;
+
+		QElapsedTimer t;
+		t.start();
+		lt = new LookupTable(blockDatabase(aTable), aTable,
+							 replaceLine(queriesMap[aTable], 0, false, false), options.at(1), maxRows);
+		lookupMap.insert(aTable, lt);
+		if (!lt->load())
+		{
+			logger->errorMsg(tr("loading lookup table %1: %2").arg(aTable, lt->getLastError()));
+		}
+		else if (lt->isPreloaded())
+		{
+			logger->debugMsg(tr("lookup table %1 loaded in %2 ms").arg(aTable).arg(t.elapsed()));
+		}
+		else
+		{
+			logger->infoMsg(tr("lookup table %1 has more than %2 rows, using single row queries")
+							.arg(aTable).arg(maxRows));
+		}
+	}
+
+	if (nullptr != lt && !lt->lookup(aKey, aColumn, v))
+	{
+		if (!lt->getLastError().isEmpty())
+		{
+			logger->errorMsg(tr("lookup %1: %2").arg(aTable, lt->getLastError()));
+		}
+		return false;
+	}
+	if (nullptr != recorder && !isReplay())
+	{
+		recorder->recordLookup(aTable, aKey, aColumn, v);
+	}
+
+	aValue = v.toByteArray();
+	if (mQSE->getOutputXml())
+	{
+		aValue.replace("<", "&lt;");
+		aValue.replace(">","&gt;");
+	}
+
+	return true;
+}
+
+//! The blocks ::SETUP and ::TEARDOWN (optional with the database type like
+//! ::SETUP.QPSQL) contain statements and no queries for a template.
+bool QueryExecutor::isStatementBlock(const QString &name) const
+{
+	QString blockName = name.section('.', 0, 0);
+	return "SETUP" == blockName || "TEARDOWN" == blockName;
+}
+
+//! Execute all statements of the SETUP or TEARDOWN block in order, the
+//! database specific block is used if it exists. Every statement is timed.
+//! \return false if a statement fails, the remaining statements are skipped
+bool QueryExecutor::executeStatements(const QString &aBlock)
+{
+	QString blockName = aBlock;
+	if (queriesMap.contains(QString("%1.%2").arg(aBlock, databaseType)))
+	{
+		blockName = QString("%1.%2").arg(aBlock, databaseType);
+	}
+	if (!queriesMap.contains(blockName))
+	{
+		return true;
+	}
+
+	QElapsedTimer total;
+	total.start();
+	QStringList statements = SqlDialect::splitStatements(replaceLine(queriesMap[blockName], 0, false, false));
+	foreach (const QString &stmt, statements)
+	{
+		QElapsedTimer t;
+		t.start();
+		QSqlDatabase db = blockDatabase(blockName);
+		QSqlQuery q(db);
+		bool ok = false;
+		{
+			ThrottleGuard guard(db);
+			ok = q.exec(stmt);
+		}
+		if (!ok)
+		{
+			logger->errorMsg(tr("%1: executing SQL '%2' (%3)").arg(blockName, stmt, q.lastError().text()));
+			return false;
+		}
+		logger->infoMsg(tr("%1: %2 rows affected in %3 by '%4'")
+						.arg(blockName).arg(q.numRowsAffected())
+						.arg(Utility::formatMilliSeconds(t.elapsed()), stmt));
+	}
+	logger->infoMsg(tr("%1: %2 statements executed in %3")
+					.arg(blockName).arg(statements.size()).arg(Utility::formatMilliSeconds(total.elapsed())));
+
+	return true;
+}
+
 //! A method to add the sql query to the internal map.
 void QueryExecutor::addSqlQuery(const QString &name, const QString &sqlLine)
 {
-	if (prepareQueries)
+	// all setup and teardown blocks are executed in the given order
+	if (isStatementBlock(name))
 	{
-        logger->debugMsg(QString("Adding Prepared SQL-Query '%1'").arg(name));
+        logger->debugMsg(QString("Adding SQL-Statements '%1'").arg(name));
+		queriesMap[name] = queriesMap.contains(name) ? queriesMap[name] + ";" + sqlLine : sqlLine;
+		return;
+	}
+
+    logger->debugMsg(QString("Adding SQL-Query '%1'").arg(name));
+	queriesMap[name] = sqlLine;
+}
+
+//! The queries are prepared after the database is connected, the SQL file
+//! is read before to know the connections with SETUP and TEARDOWN blocks.
+void QueryExecutor::prepareSqlQueries()
+{
+	if (!prepareQueries || isReplay())
+	{
+		return;
+	}
+
+	foreach (const QString &name, queriesMap.keys())
+	{
+		// lookup tables are loaded once and result blocks contain several
+		// statements, there is nothing to prepare
+		QString blockType = queryOptionsMap.value(name).value(0);
+		if (isStatementBlock(name) || "LOOKUP" == blockType || "RESULTS" == blockType)
+		{
+			continue;
+		}
 
-		QString tempPrepQuery = replaceLine(sqlLine, 0, true, false);
+        logger->debugMsg(QString("Adding Prepared SQL-Query '%1'").arg(name));
+		QString tempPrepQuery = replaceLine(queriesMap.take(name), 0, true, false);
         logger->debugMsg(tr("prepared sql query: %1").arg(tempPrepQuery));
-		QSqlQuery q(QSqlDatabase::database());
+		QSqlQuery q(blockDatabase(name));
 		bool qb = q.prepare(tempPrepQuery);
 		if (!qb)
 		{
@@ -531,11 +767,30 @@ void QueryExecutor::addSqlQuery(const QString &name, const QString &sqlLine)
 			preparedQueriesMap[name] = q;
 		}
 	}
-	else
+}
+
+//! The connections with statement blocks are used for changes, all other
+//! connections are read only and can use a replica.
+//! \return true if a SETUP or TEARDOWN block is executed at the connection,
+//! an empty name is the default connection
+bool QueryExecutor::hasStatements(const QString &aConnection) const
+{
+	QMapIterator<QString, QString> it(queriesMap);
+	while (it.hasNext())
 	{
-        logger->debugMsg(QString("Adding SQL-Query '%1'").arg(name));
-		queriesMap[name] = sqlLine;
-    }
+		it.next();
+		QString name = queryConnectionMap.value(it.key());
+		if (nullptr != defaultConnection && defaultConnection->getName() == name)
+		{
+			name = "";
+		}
+		if (isStatementBlock(it.key()) && name == aConnection)
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
 QString QueryExecutor::convertRtf(QString rtfText, QString resultType, bool cleanupFont)
@@ -659,10 +914,8 @@ QString QueryExecutor::convertRtf(QString rtfText, QString resultType, bool clea
     return "";
 }
 
-//! This is the start method to fill the internal structures
-//! to create the output.
-//! This is also the place where the output stream is opened.
-bool QueryExecutor::executeInputFiles()
+//! Read the SQL blocks of the query set into the internal structures.
+bool QueryExecutor::readSqlFile()
 {
 	bool bRet = true;
 	QString name, line;
@@ -696,13 +949,29 @@ bool QueryExecutor::executeInputFiles()
                             addSqlQuery(name, sqlLine);
 						}
 
-                        // start new SQL Query
+                        // start new SQL Query, the name can followed by options
+                        // like ::NAME,KEYSET,keycolumn
                         sqlLine = "";
-                        name = line.mid(2).trimmed();
-                        if (queriesMap.contains(name))
+                        QStringList nameOptions = line.mid(2).split(',');
+                        name = nameOptions.takeFirst().trimmed();
+                        QString connection = name.section('@', 1).trimmed();
+                        name = name.section('@', 0, 0).trimmed();
+                        queryConnectionMap.remove(name);
+                        if (!connection.isEmpty())
+                        {
+                            queryConnectionMap[name] = connection;
+                        }
+                        if (queriesMap.contains(name) && !isStatementBlock(name))
                         {
                             logger->warnMsg(tr("Overwrite SQL-Query '%1' at line %2").arg(name).arg(lineNr));
                             queriesMap.remove(name);
+                        }
+                        queryOptionsMap.remove(name);
+                        if (!nameOptions.isEmpty())
+                        {
+                            for (QString &o : nameOptions) o = o.trimmed();
+                            nameOptions[0] = nameOptions.at(0).toUpper();
+                            queryOptionsMap[name] = nameOptions;
                         }
 					}
 					else
@@ -728,6 +997,18 @@ bool QueryExecutor::executeInputFiles()
 		}
 	}
 
+	return bRet;
+}
+
+//! This is the start method to fill the internal structures
+//! to create the output, the SQL blocks are read before.
+//! This is also the place where the output stream is opened.
+bool QueryExecutor::executeInputFiles()
+{
+	bool bRet = true;
+	QString name, line;
+	int lineNr = 0;
+
 	// open and read the template file
     QFile fileTemplate(templateFileName);
 	if (!fileTemplate.open(QIODevice::ReadOnly | QIODevice::Text))
@@ -804,7 +1085,27 @@ bool QueryExecutor::executeInputFiles()
         }
 	}
 
-	if (nullptr != mQSE)
+	if (nullptr != mQSE && mQSE->getExecuteOutput() && isReplay())
+	{
+		logger->infoMsg(tr("replay run, the statements are written to the output file"));
+	}
+	else if (nullptr != mQSE && mQSE->getExecuteOutput())
+	{
+		// the output is a list of SQL statements executed at the report database
+		batchOut = new SqlBatchDevice(QSqlDatabase::database(), mQSE->getTransactionSize(), logger, this);
+		if (!batchOut->open(QIODevice::WriteOnly))
+		{
+			bRet = false;
+		}
+		else
+		{
+			logger->infoMsg(tr("execute output at database using transactions of %1 statements")
+							.arg(mQSE->getTransactionSize()));
+			streamOut.setDevice(batchOut);
+			streamOut.setEncoding(QStringEncoder::Encoding::Utf8);
+		}
+	}
+	else if (nullptr != mQSE)
 	{
 		// open the output file, create missing path
 		fileOut.setFileName(mQSE->getLastOutputFile());
@@ -957,91 +1258,307 @@ QString QueryExecutor::replaceLine(const QString &aLine, int aLineCnt, bool sqlB
 	return result;
 }
 
+//! Encode a large value in chunks directly into the result, this
+//! prevents the complete encoded copy and its conversion to QString.
+void QueryExecutor::appendEncoded(QString &result, const QByteArray &aData, bool base64) const
+{
+    // a multiple of 3 bytes creates base64 chunks without padding
+    const qsizetype chunkSize = 3 * 65536;
+    qsizetype len = aData.size();
+
+    result.reserve(result.size() + (base64 ? (len + 2) / 3 * 4 : 2 * len));
+    for (qsizetype pos = 0; pos < len; pos += chunkSize)
+    {
+        QByteArray chunk = QByteArray::fromRawData(aData.constData() + pos, qMin(chunkSize, len - pos));
+        result += QLatin1String(base64 ? chunk.toBase64() : chunk.toHex());
+    }
+}
+
+//! Write the value in chunks to the file, a relative file name is
+//! relative to the output file. Empty values create no file.
+//! \return the file name or an empty string
+QString QueryExecutor::writeValueToFile(const QByteArray &aData, const QString &aFileName)
+{
+    const qsizetype chunkSize = 1024 * 1024;
+
+    if (aData.isEmpty() || aFileName.trimmed().isEmpty())
+    {
+        return QString("");
+    }
+
+    QFileInfo fi(QFileInfo(mQSE->getLastOutputFile()).absoluteDir(), aFileName.trimmed());
+    QDir().mkpath(fi.absolutePath());
+
+    QFile f(fi.absoluteFilePath());
+    if (!f.open(QIODevice::WriteOnly))
+    {
+        logger->errorMsg(tr("Can't open file '%1'").arg(fi.absoluteFilePath()));
+        return QString("");
+    }
+
+    for (qsizetype pos = 0; pos < aData.size(); pos += chunkSize)
+    {
+        if (f.write(aData.constData() + pos, qMin(chunkSize, aData.size() - pos)) < 0)
+        {
+            logger->errorMsg(tr("writing file '%1' (%2)").arg(fi.absoluteFilePath(), f.errorString()));
+            break;
+        }
+    }
+    f.close();
+
+    return aFileName.trimmed();
+}
+
+//! The number of bytes of the text encoded as UTF-8.
+static quint64 utf8Size(QStringView aText)
+{
+    quint64 n = 0;
+    for (QChar c : aText)
+    {
+        ushort u = c.unicode();
+        // a surrogate pair is encoded with 4 bytes, 2 for every half
+        n += u < 0x80 ? 1 : (u < 0x800 || c.isSurrogate() ? 2 : 3);
+    }
+
+    return n;
+}
+
+//! Write the text in chunks, so a large value isn't converted by the
+//! encoder of the output stream at once. All output passes this method,
+//! also line feeds and separators, so the output limit sees every byte.
+void QueryExecutor::writeOutput(QStringView aText)
+{
+    const qsizetype chunkSize = 65536;
+
+    // the output limit counts the bytes written to the file
+    addUsage(currentTemplateBlockName, 0, 0, QStringConverter::Utf8 == streamOut.encoding()
+             ? utf8Size(aText) : static_cast<quint64>(aText.size()));
+    for (qsizetype pos = 0; pos < aText.size(); pos += chunkSize)
+    {
+        streamOut << aText.mid(pos, chunkSize);
+    }
+}
+
 QString QueryExecutor::getDate(const QString &aFormat) const
 {
 	QDateTime mNow = QDateTime::currentDateTime();
     return QLocale::system().toString( mNow, aFormat);
 }
 
-//! This method expands all lines of the given template list.
-//! \return true if the calling method has to add a linefeed
-bool QueryExecutor::replaceTemplate(const QStringList *aTemplLines, int aLineCnt)
+//! This method expands the template lines of the frame starting at the
+//! current position. If a template call #{...} is found the text before
+//! is written, the position is saved and the call is returned.
+//! \return true if all lines are written, false if the call must be executed first
+bool QueryExecutor::replaceTemplate(TemplateFrame *aFrame, QString &aCall)
 {
-    QRegularExpression rx("\\#\\{([^\\}]*)\\}"); // all expressions like #{...} capture the ... part
-	QString tmpName, result;
-	bool vRes = false;
-	int vLineNum=0, pos=0, lpos=0;
-	QString vStr("");
-
-	vLineNum = aTemplLines->size();
-    mTreeNodeChanged = false;
-	result = "";
-	for (int i = 0; i < vLineNum; ++i)
-	{
-		bool lastLine = ((i+1) == vLineNum);
-		vStr = aTemplLines->at(i);
-		lpos = 0;
-
-        QRegularExpressionMatchIterator expit = rx.globalMatch(vStr);
-        while (expit.hasNext())
-        {
-          QRegularExpressionMatch match = expit.next();
-          pos = match.capturedStart();
+    // all expressions like #{...} capture the ... part, variables ${...} inside are allowed
+    static const QRegularExpression rx("\\#\\{((?:[^\\}\\$]|\\$\\{[^\\}]*\\}|\\$(?!\\{))*)\\}");
+	const QStringList *templLines = aFrame->templLines;
+	int vLineNum = templLines->size();
+
+	if (aFrame->rendered)
+	{
+		// the database returns the finished lines of the row
+		writeOutput(QString::fromUtf8(aFrame->source->value(0).toByteArray()));
+		aFrame->lastReplaceLinefeed = aFrame->renderedLinefeed;
+		aFrame->lineIdx = vLineNum;
+		return true;
+	}
 
-            tmpName = match.captured(1);
-			result = vStr.mid(lpos,pos-lpos);
-			streamOut << replaceLine(result, aLineCnt, false, false);
-            lpos = pos + match.capturedLength();
+	while (aFrame->lineIdx < vLineNum)
+	{
+		const QString &vStr = templLines->at(aFrame->lineIdx);
+
+		QRegularExpressionMatch match = rx.match(vStr, aFrame->linePos);
+		if (match.hasMatch())
+		{
+			QString result = vStr.mid(aFrame->linePos, match.capturedStart() - aFrame->linePos);
+			writeOutput(replaceLine(result, aFrame->lineCnt, false, false));
+			aFrame->linePos = match.capturedEnd();
 			// now add the subtemplate
-            outputTemplate(tmpName);
+			aCall = match.captured(1);
+			return false;
 		}
 
-		QString tmpStr = vStr.mid(lpos);
-		result = replaceLine(tmpStr, aLineCnt, false, false);
+		bool lastLine = ((aFrame->lineIdx + 1) == vLineNum);
+		QString result = replaceLine(vStr.mid(aFrame->linePos), aFrame->lineCnt, false, false);
+		aFrame->lineIdx++;
+		aFrame->linePos = 0;
+
 		if (result.endsWith("\\"))
 		{
 			// remove the last backslash sign
-			result = result.mid(0,result.length()-1);
-			streamOut << result;
+			writeOutput(QStringView(result).mid(0,result.length()-1));
 		}
 		else
 		{
 			// we need to add a linefeed, but not for the last
-			// line, that is added in outputTemplate
+			// line, that is added by the next row or at the end
 			if (!lastLine)
 			{
-				streamOut << result << "\n";
+				writeOutput(result);
+				writeOutput(u"\n");
 			}
 			else
 			{
-				streamOut << result;
-				vRes = true;
+				writeOutput(result);
+				aFrame->lastReplaceLinefeed = true;
 			}
 		}
 	}
 
-	return vRes;
+	return true;
 }
 
 //! This is the heart of the executor. This method controls the SQL
-//! query execution, the output generating and is called recursiv
-//! to execute inner templates.
-//! All SQL results stored as QString in the hash mReplacements. Same
-//! column names hides the outer names and will be restored when leaving the
-//! method.
+//! query execution and the output generating. Inner templates are not
+//! called recursive, every call is a frame at the heap allocated frame
+//! stack and the loop works always at the top frame.
+//! All SQL results stored as QByteArray in the hash replacements. Same
+//! column names hides the outer names and will be restored when the
+//! frame is removed.
 bool QueryExecutor::outputTemplate(QString aTemplate)
+{
+	QString lastTemplateName = currentTemplateBlockName;
+	qsizetype baseDepth = frames.size();
+
+	bool bRet = pushTemplate(aTemplate);
+	TemplateFrame *firstFrame = frames.size() > baseDepth ? frames.last() : nullptr;
+
+	while (frames.size() > baseDepth)
+	{
+		if (limitExceeded || !checkBudget())
+		{
+			// clean abort, the frames are removed and the replacements restored
+			popTemplate();
+			continue;
+		}
+
+		TemplateFrame *f = frames.last();
+		currentTemplateBlockName = f->templateName;
+		logger->setContext(currentTemplateBlockName);
+		firstQueryResult = f->firstQueryResult;
+
+		if (f->rowActive)
+		{
+			QString call;
+			if (replaceTemplate(f, call))
+			{
+				f->rowActive = false;
+				if (nullptr != f->source)
+				{
+					uniqueId++;
+					f->lineCnt++;
+				}
+				f->firstQueryResult = false;
+			}
+			else
+			{
+				(void) pushTemplate(call);
+			}
+		}
+		else if (!f->finished)
+		{
+			if (!nextTemplateRow(f))
+			{
+				f->finished = true;
+				if (nullptr != f->block)
+				{
+					f->block->addRows(f->rowCount);
+				}
+				if (!f->source->getLastError().isEmpty())
+				{
+					f->result = false;
+					logger->errorMsg(tr("reading rows for template %1: %2")
+									 .arg(f->templateName, f->source->getLastError()));
+				}
+				else if (!f->source->statistics().isEmpty())
+				{
+					logger->debugMsg(f->source->statistics());
+				}
+
+				if (f->empty)
+				{
+					(void) pushTemplate(f->templateName + "_EMPTY");
+				}
+				else if (f->lastReplaceLinefeed)
+				{
+					// add the deferred linefeed from the last row
+					writeOutput(u"\n");
+				}
+			}
+		}
+		else
+		{
+			if (f == firstFrame)
+			{
+				bRet = bRet && f->result;
+			}
+			popTemplate();
+		}
+	}
+
+    currentTemplateBlockName = lastTemplateName;
+    logger->setContext(currentTemplateBlockName);
+
+	return bRet && !limitExceeded;
+}
+
+//! Split a template call at the commas outside of variables, so an
+//! argument like ${tags,JSON} stays one part.
+static QStringList splitCall(const QString &aCall)
+{
+	QStringList parts;
+	qsizetype start = 0;
+	int depth = 0;
+	for (qsizetype i = 0; i < aCall.size(); ++i)
+	{
+		QChar c = aCall.at(i);
+		if ('$' == c && i + 1 < aCall.size() && '{' == aCall.at(i + 1))
+		{
+			depth++;
+			++i;
+		}
+		else if ('{' == c && depth > 0)
+		{
+			depth++;
+		}
+		else if ('}' == c && depth > 0)
+		{
+			depth--;
+		}
+		else if (',' == c && 0 == depth)
+		{
+			parts << aCall.mid(start, i - start);
+			start = i + 1;
+		}
+	}
+	parts << aCall.mid(start);
+
+	return parts;
+}
+
+//! Prepare the call of a template block, this evaluates the modifiers,
+//! executes the query and put a new frame at the stack.
+//! \return false if the call creates an error
+bool QueryExecutor::pushTemplate(QString aTemplate)
 {
 	QSqlQuery query;                // hold the sql query
 	const QStringList *templLines;  // the lines of the template
 	QString listSeperator("");      // used with the ,list modifier
 	int lineCnt = 0;                //
 	bool bRet = true;
-	bool lastReplaceLinefeed = false;
-    QHash<QString, QByteArray> overwrittenReplacements;
-    QString lastTemplateName = currentTemplateBlockName;
+
+	if (frames.size() >= mQSE->getMaxDepth())
+	{
+		logger->errorMsg(tr("template call '%1' exceeds the nesting depth of %2")
+						 .arg(aTemplate).arg(mQSE->getMaxDepth()));
+		limitExceeded = true;
+		return false;
+	}
 
 	// split the given aTemplate into parts separated by comma
-	QStringList ll = aTemplate.split(',');
+	QStringList ll = splitCall(aTemplate);
 	aTemplate = ll.at(0).trimmed();
 	QString outputModifier = ll.size()>1 ? ll.at(1).trimmed().toUpper() : "";
 
@@ -1082,6 +1599,22 @@ bool QueryExecutor::outputTemplate(QString aTemplate)
         }
     }
 
+	// the number of rows is limited at a preview run or by #{NAME,LIMIT,n}
+	qint32 rowLimit = previewRun ? previewRows : 0;
+	if ("LIMIT" == outputModifier && ll.size() > 2)
+	{
+		bool bOk = false;
+		qint32 n = ll.at(2).trimmed().toInt(&bOk);
+		if (bOk && n > 0)
+		{
+			rowLimit = previewRun ? qMin(n, previewRows) : n;
+		}
+		else
+		{
+			logger->errorMsg(tr("LIMIT needs a positive number of rows, found '%1'").arg(ll.at(2)));
+		}
+	}
+
     // first check the calling template string for more informations
 	if ("LIST" == outputModifier)
 	{
@@ -1122,15 +1655,192 @@ bool QueryExecutor::outputTemplate(QString aTemplate)
             queryTemplate = queryTemplateDb;
         }
 
-		if (queriesMap.contains(queryTemplate))
-		{
-            logger->debugMsg(tr("output template %1 using query %2").arg(aTemplate, queryTemplate));
-			QString sqlQuery;
+		QScopedPointer<RowSource> source;
+		AdaptiveBlock *block = nullptr;
+		bool rendered = false;
+		bool renderLinefeed = false;
 
-			if (prepareQueries && preparedQueriesMap.contains(queryTemplate))
+		// the rows are recorded with the SQL text as key
+		QString recordSql;
+		QString resultBlock = queriesMap.contains(queryTemplate) ? QString("") : resultSetBlock(queryTemplate);
+		if (nullptr != recorder && "FOREACH" != outputModifier && queriesMap.contains(queryTemplate)
+				&& "HIERARCHY" != queryOptionsMap.value(queryTemplate).value(0))
+		{
+			recordSql = replaceLine(queriesMap[queryTemplate], lineCnt, false, false);
+			if ("MERGE" == outputModifier && ll.size() > 2)
 			{
-				// development case prepared queris
-				query = preparedQueriesMap[queryTemplate];
+				recordSql += "\n-- merge " + QString(replacements.value(ll.at(2).trimmed()));
+			}
+		}
+		else if (nullptr != recorder && "FOREACH" != outputModifier && !resultBlock.isEmpty())
+		{
+			recordSql = replaceLine(queriesMap[resultBlock], lineCnt, false, false)
+						+ "\n-- result " + queryTemplate;
+		}
+
+		if (!recordSql.isEmpty() && isReplay())
+		{
+			source.reset(recorder->replay(queryTemplate, recordSql));
+			addUsage(aTemplate, 0, 1, 0);
+			if (source.isNull())
+			{
+				logger->errorMsg(tr("the query of block %1 isn't recorded: %2").arg(aTemplate, recordSql));
+				return false;
+			}
+		}
+		else if ("FOREACH" == outputModifier)
+		{
+			// iterate over the elements of a value without a database query
+			QString listExpr = ll.size() > 2 ? ll.at(2).trimmed() : QString("");
+			QString listFormat = ll.size() > 3 ? ll.at(3).trimmed() : QString("");
+			QByteArray listValue;
+			if (listExpr.contains('$'))
+			{
+				listValue = replaceLine(listExpr, lineCnt, false, !listExpr.contains("${")).toUtf8();
+			}
+			else
+			{
+				listValue = replacements.value(listExpr);
+			}
+			logger->debugMsg(tr("output template %1 for each element of '%2'").arg(aTemplate, listExpr));
+			source.reset(new ListRowSource(listValue, listFormat));
+		}
+		else if ("MERGE" == outputModifier && ll.size() > 2 && queriesMap.contains(queryTemplate))
+		{
+			// the child rows are read from a single ordered query
+			source.reset(mergeRows(queryTemplate, ll.at(2).trimmed(),
+								   ll.size() > 3 ? ll.at(3).trimmed() : ll.at(2).trimmed()));
+			if (source.isNull())
+			{
+				addUsage(aTemplate, 0, 1, 0);
+				return false;
+			}
+		}
+		else if (!resultBlock.isEmpty())
+		{
+			// the rows are a result set of the query of a RESULTS block, all
+			// result sets are read together at the first call of one block and
+			// read again if the variables of the query have other values
+			QString resultSql = replaceLine(queriesMap[resultBlock], lineCnt, false, false);
+			if ((!resultSets.contains(queryTemplate) || resultSetSql.value(resultBlock) != resultSql)
+					&& !loadResultSets(resultBlock, resultSql))
+			{
+				return false;
+			}
+			if (!resultSets.contains(queryTemplate))
+			{
+				logger->errorMsg(tr("block %1 doesn't return a result set for %2").arg(resultBlock, queryTemplate));
+				return false;
+			}
+			logger->debugMsg(tr("output template %1 using a result set of %2").arg(aTemplate, resultBlock));
+			source.reset(new MemoryRowSource(resultSets.take(queryTemplate)));
+		}
+		else if (queriesMap.contains(queryTemplate))
+		{
+            logger->debugMsg(tr("output template %1 using query %2").arg(aTemplate, queryTemplate));
+			QString sqlQuery;
+			QSqlDatabase blockDb = blockDatabase(queryTemplate);
+			query = QSqlQuery(blockDb);
+			QStringList queryOptions = queryOptionsMap.value(queryTemplate);
+			freeThrottleSlots(blockDb);
+
+			if (!queryOptions.isEmpty() && "HIERARCHY" == queryOptions.at(0))
+			{
+				HierarchyRowSource *parentNode = nullptr;
+				for (qsizetype i = frames.size() - 1; nullptr == parentNode && i >= 0; --i)
+				{
+					HierarchyRowSource *h = dynamic_cast<HierarchyRowSource*>(frames.at(i)->source);
+					if (nullptr != h && h->getName() == queryTemplate)
+					{
+						parentNode = h;
+					}
+				}
+
+				if (nullptr != parentNode)
+				{
+					// a nested call renders the children of the current node from memory
+					source.reset(parentNode->childSource());
+				}
+				else if (queryOptions.size() < 3)
+				{
+					logger->errorMsg(tr("hierarchy block %1 needs the id and the parent column").arg(queryTemplate));
+					return false;
+				}
+				else
+				{
+					// read the whole table once and build the parent/child index
+					sqlQuery = replaceLine(queriesMap[queryTemplate], lineCnt, false, false);
+					logger->debugMsg(tr("SQL-Query for hierarchy on %1,%2: %3")
+									 .arg(queryOptions.at(1), queryOptions.at(2), sqlQuery));
+					QElapsedTimer t;
+					t.start();
+					query.setForwardOnly(true);
+					{
+						ThrottleGuard guard(blockDb);
+						bRet = query.exec(sqlQuery);
+					}
+					addUsage(aTemplate, 0, 1, 0);
+					if (bRet)
+					{
+						QSharedPointer<HierarchyIndex> idx(new HierarchyIndex(queryTemplate, query,
+																			  queryOptions.at(1), queryOptions.at(2)));
+						if (!idx->getLastError().isEmpty())
+						{
+							logger->errorMsg(tr("hierarchy block %1: %2").arg(queryTemplate, idx->getLastError()));
+							return false;
+						}
+						logger->infoMsg(tr("hierarchy %1 with %2 nodes and %3 roots loaded in %4 ms")
+										.arg(queryTemplate).arg(idx->nodeCount()).arg(idx->roots().size())
+										.arg(t.elapsed()));
+						if (idx->unreachableCount() > 0)
+						{
+							logger->warnMsg(tr("hierarchy %1 ignores %2 nodes which are part of a cycle")
+											.arg(queryTemplate).arg(idx->unreachableCount()));
+						}
+						source.reset(new HierarchyRowSource(idx));
+					}
+				}
+			}
+			else if (queryOptions.size() > 3 && "PIVOT" == queryOptions.at(0))
+			{
+				// ::NAME,PIVOT,rowkey,columnkey,value[,default[,col1;col2;...]]
+				sqlQuery = replaceLine(queriesMap[queryTemplate], lineCnt, false, false);
+				logger->debugMsg(tr("SQL-Query for pivot: %1").arg(sqlQuery));
+				query.setForwardOnly(true);
+				{
+					ThrottleGuard guard(blockDb);
+					bRet = query.exec(sqlQuery);
+				}
+				addUsage(aTemplate, 0, 1, 0);
+				if (bRet)
+				{
+					QVariant defaultValue = queryOptions.size() > 4 ? QVariant(queryOptions.at(4)) : QVariant();
+					QStringList columns = queryOptions.size() > 5
+							? queryOptions.at(5).split(';', Qt::SkipEmptyParts) : QStringList();
+					for (QString &c : columns) c = c.trimmed();
+					source.reset(new PivotRowSource(query, queryOptions.at(1), queryOptions.at(2),
+													queryOptions.at(3), defaultValue, columns));
+				}
+			}
+			else if (queryOptions.size() > 1 && "KEYSET" == queryOptions.at(0))
+			{
+				// read the query in pages ordered by the key column
+				sqlQuery = replaceLine(queriesMap[queryTemplate], lineCnt, false, false);
+				if (rowLimit > 0)
+				{
+					sqlQuery = SqlDialect::limitQuery(blockDbType(queryTemplate), sqlQuery, rowLimit);
+				}
+				qint32 pageSize = queryOptions.size() > 2 ? queryOptions.at(2).toInt() : 0;
+				qint32 targetMs = queryOptions.size() > 3 ? queryOptions.at(3).toInt() : 0;
+				logger->debugMsg(tr("SQL-Query with keyset pagination on %1: %2").arg(queryOptions.at(1), sqlQuery));
+				addUsage(aTemplate, 0, 1, 0);
+				source.reset(new KeysetRowSource(blockDb, blockDbType(queryTemplate), sqlQuery,
+												 queryOptions.at(1), pageSize, targetMs));
+			}
+			else if (prepareQueries && preparedQueriesMap.contains(queryTemplate))
+			{
+				// development case prepared queris
+				query = preparedQueriesMap[queryTemplate];
                 QVariantList list = query.boundValues();
 
                 for (int i = 0; i < list.size(); ++i)
@@ -1144,7 +1854,11 @@ bool QueryExecutor::outputTemplate(QString aTemplate)
                     }
                     query.bindValue(i, replacements[bv2]);
 				}
-				bRet = query.exec();
+				{
+					ThrottleGuard guard(blockDb);
+					bRet = query.exec();
+				}
+				addUsage(aTemplate, 0, 1, 0);
 
                 if (logger->isTrace())
                 {
@@ -1154,21 +1868,78 @@ bool QueryExecutor::outputTemplate(QString aTemplate)
 			else
 			{
 				sqlQuery = replaceLine(queriesMap[queryTemplate], lineCnt, false, false);
-				bRet = query.exec(sqlQuery);
+				if (rowLimit > 0)
+				{
+					// push the limit into the query, the database reads only the needed rows
+					sqlQuery = SqlDialect::limitQuery(blockDbType(queryTemplate), sqlQuery, rowLimit);
+				}
+
+				// a block with plain column references is rendered by the database, a
+				// failed statement aborts a snapshot transaction or the open transaction
+				// of executed output statements, so it isn't tried then, the watermark
+				// of a MAIN block needs the column values of every row
+				QString renderSql;
+				if (mQSE->getPushdownRender() && !mQSE->getSnapshot() && nullptr == recorder
+						&& nullptr == batchOut
+						&& ("MAIN" != aTemplate || mQSE->getWatermarkColumn().isEmpty())
+						&& queryOptions.isEmpty() && !clientRendered.contains(aTemplate)
+						&& ("" == outputModifier || "LIST" == outputModifier || "LIMIT" == outputModifier))
+				{
+					renderSql = renderedQuery(queryTemplate, sqlQuery, templLines, renderLinefeed);
+				}
+				if (!renderSql.isEmpty())
+				{
+					{
+						ThrottleGuard guard(blockDb);
+						rendered = query.exec(renderSql);
+					}
+					addUsage(aTemplate, 0, 1, 0);
+					if (rendered)
+					{
+						sqlQuery = renderSql;
+						bRet = true;
+					}
+					else
+					{
+						logger->infoMsg(tr("block %1 is rendered by the client (%2)").arg(aTemplate, query.lastError().text()));
+						clientRendered.insert(aTemplate);
+						query = QSqlQuery(blockDb);
+					}
+				}
+
+				// a preview run changes the statistics, so the strategy isn't used
+				block = (previewRun || rendered) ? nullptr : nestedBlock(queryTemplate, queryOptions);
+				QElapsedTimer t;
+				t.start();
+				if (nullptr != block)
+				{
+					source.reset(adaptiveRows(block, sqlQuery));
+				}
+				if (source.isNull() && !rendered)
+				{
+					ThrottleGuard guard(blockDb);
+					bRet = query.exec(sqlQuery);
+					addUsage(aTemplate, 0, 1, 0);
+				}
+				if (nullptr != block)
+				{
+					block->addCall(sqlQuery, t.nsecsElapsed());
+				}
 			}
 
-			if (bRet)
+			if (bRet && source.isNull() && nullptr != block && AdaptiveBlock::Cache == block->getStrategy())
+			{
+				source.reset(block->cacheQuery(query, sqlQuery));
+			}
+			else if (bRet && source.isNull())
 			{
-				QSqlRecord rec = query.record();
-				int numCols = rec.count();
-				bool empty = true;
-
                 if (logger->isDebug())
 				{
                     logger->debugMsg("SQL-Query: "+sqlQuery);
                     if (logger->isTrace())
 					{
-						for (int i=0; i<numCols; ++i)
+						QSqlRecord rec = query.record();
+						for (int i=0; i<rec.count(); ++i)
 						{
                             logger->traceMsg(QString("column %1 name '%2' : %3")
                                     .arg(i)
@@ -1177,105 +1948,904 @@ bool QueryExecutor::outputTemplate(QString aTemplate)
                         logger->traceMsg(tr("Size of result is %1").arg(query.size()));
 					}
 				}
+				source.reset(new QueryRowSource(query));
+			}
+			else if (!bRet)
+			{
+				QString errText = query.lastError().text();
+				writeOutput(QString("## error executing %1 ## %2##").arg(sqlQuery, errText));
+                logger->errorMsg(tr("executing SQL '%1' (%2)").arg(sqlQuery, errText));
+			}
+		}
 
-				firstQueryResult = true;
-				while (query.next())
-				{
-					QCoreApplication::processEvents();
-					// add a optional list seperator
-					if (!firstQueryResult && !listSeperator.isEmpty())
-					{
-						streamOut << listSeperator;
-					}
-					// add the deferred linefeed from the last replaceTemplate call
-					if (lastReplaceLinefeed)
-					{
-						streamOut << "\n";
-					}
+		if (!source.isNull() && !recordSql.isEmpty() && !isReplay())
+		{
+			source.reset(recorder->record(queryTemplate, recordSql, source.take()));
+		}
 
-					//get the sql values
-					for (int i=0; i<numCols; ++i)
-                    {
-                        QByteArray tmpStr = query.value(i).toByteArray();
+		if (!source.isNull() || !queriesMap.contains(queryTemplate))
+		{
+			TemplateFrame *f = new TemplateFrame();
+			f->templateName = aTemplate;
+			f->templLines = templLines;
+			f->listSeperator = listSeperator;
+			f->source = source.take();
+			f->block = block;
+			f->rowLimit = rowLimit;
+			f->rendered = rendered;
+			f->renderedLinefeed = renderLinefeed;
+			if (nullptr != f->source && queriesMap.contains(queryTemplate))
+			{
+				// the open cursor counts for maxConcurrentQueries of the connection
+				f->source->holdSlot(QueryThrottle::forConnection(blockDatabase(queryTemplate).connectionName()));
+			}
+			if (nullptr == f->source)
+			{
+				// a standalone template without new data, the lines are
+				// written once and the last linefeed is ignored, because a
+				// not data driven template can't create a list.
+				f->rowActive = true;
+				f->finished = true;
+				mTreeNodeChanged = false;
+			}
+			frames.append(f);
+			limitOpenCursors();
+		}
+	}
+	else
+	{
+		if (!aTemplate.endsWith("_EMPTY"))
+		{
+            logger->errorMsg(tr("template %1 isn't defined").arg(aTemplate));
+		}
+	}
 
-                        if (empty) empty = query.isNull(i);
-						if (mQSE->getOutputXml())
-						{
-							tmpStr.replace("<", "&lt;");
-							tmpStr.replace(">","&gt;");
-						}
-						QString tmpFieldName = rec.fieldName(i);
+	return bRet;
+}
 
-						if (replacements.contains(tmpFieldName))
-						{
-							overwrittenReplacements[tmpFieldName] = replacements[tmpFieldName];
-						}
-						replacements[tmpFieldName] = tmpStr;
+//! Read the next row of the frame source and set the replacements.
+//! \return false if there are no more rows
+bool QueryExecutor::nextTemplateRow(TemplateFrame *aFrame)
+{
+	RowSource *source = aFrame->source;
 
-                        if (logger->isTrace())
-                        {
-                            logger->traceMsg(tr("column %1 with /%2/").arg(i).arg(replacements[tmpFieldName]));
-                        }
-					}
-					if (!empty)
-					{
-						lastReplaceLinefeed = replaceTemplate(templLines, lineCnt);
-						uniqueId++;
-						lineCnt++;
-					}
-					firstQueryResult = false;
+	// the limit is checked for all sources, not only for queries
+	if (aFrame->rowCount > 0)
+	{
+		aFrame->previousRow = source->row();
+	}
+	while ((0 == aFrame->rowLimit || aFrame->rowCount < static_cast<quint64>(aFrame->rowLimit))
+		   && source->next())
+	{
+		aFrame->rowCount++;
+		addUsage(aFrame->templateName, 1, 0, 0);
+		if ("MAIN" == aFrame->templateName && !mQSE->getWatermarkColumn().isEmpty())
+		{
+			qsizetype wi = source->row().fields.indexOf(mQSE->getWatermarkColumn());
+			if (wi >= 0 && !source->row().values.at(wi).isNull()
+					&& (!watermarkMax.isValid() || Utility::compareValues(source->row().values.at(wi), watermarkMax) > 0))
+			{
+				watermarkMax = source->row().values.at(wi);
+			}
+		}
+		QCoreApplication::processEvents();
+		// add a optional list seperator
+		if (!aFrame->firstQueryResult && !aFrame->listSeperator.isEmpty())
+		{
+			writeOutput(aFrame->listSeperator);
+		}
+		// add the deferred linefeed from the last row
+		if (aFrame->lastReplaceLinefeed)
+		{
+			writeOutput(u"\n");
+		}
+
+		//get the row values
+		int numCols = source->count();
+		for (int i=0; i<numCols; ++i)
+        {
+            QByteArray tmpStr = source->value(i).toByteArray();
+
+            if (aFrame->empty) aFrame->empty = source->isNull(i);
+			if (mQSE->getOutputXml())
+			{
+				tmpStr.replace("<", "&lt;");
+				tmpStr.replace(">","&gt;");
+			}
+			QString tmpFieldName = source->fieldName(i);
+
+			if (replacements.contains(tmpFieldName) && !aFrame->overwrittenReplacements.contains(tmpFieldName))
+			{
+				aFrame->overwrittenReplacements[tmpFieldName] = replacements[tmpFieldName];
+			}
+			replacements[tmpFieldName] = tmpStr;
+
+            if (logger->isTrace())
+            {
+                logger->traceMsg(tr("column %1 with /%2/").arg(i).arg(replacements[tmpFieldName]));
+            }
+		}
+
+		if (!aFrame->empty)
+		{
+			aFrame->rowActive = true;
+			aFrame->lineIdx = 0;
+			aFrame->linePos = 0;
+			aFrame->lastReplaceLinefeed = false;
+			mTreeNodeChanged = false;
+			return true;
+		}
+		aFrame->firstQueryResult = false;
+	}
+
+	return false;
+}
+
+//! Return the adaptive block for a query called inside of a data driven
+//! block, the strategy is chosen at the first call of a run.
+//! \return nullptr for a block which isn't nested
+AdaptiveBlock *QueryExecutor::nestedBlock(const QString &aQueryName, const QStringList &aOptions)
+{
+	AdaptiveBlock *ab = adaptiveBlocks.value(aQueryName, nullptr);
+	if (nullptr != ab)
+	{
+		return ab;
+	}
+
+	bool nested = false;
+	foreach (TemplateFrame *f, frames)
+	{
+		nested = nested || nullptr != f->source;
+	}
+	if (!nested || (!aOptions.isEmpty() && "STRATEGY" != aOptions.at(0)))
+	{
+		return nullptr;
+	}
+
+	ab = new AdaptiveBlock(aQueryName, queriesMap.value(aQueryName),
+						   mQSE->getBlockStatistics().value(aQueryName));
+	ab->choose(aOptions.size() > 1 ? aOptions.at(1) : QString(""));
+	adaptiveBlocks.insert(aQueryName, ab);
+	logger->infoMsg(tr("block %1 uses strategy %2: %3")
+					.arg(aQueryName, AdaptiveBlock::strategyName(ab->getStrategy()), ab->getReason()));
+
+	return ab;
+}
+
+//! Read the rows of the block call from memory if the strategy allows it.
+//! \return nullptr if the query must be executed
+RowSource *QueryExecutor::adaptiveRows(AdaptiveBlock *aBlock, const QString &aSql)
+{
+	AdaptiveBlock::Strategy strategy = aBlock->getStrategy();
+
+	if (AdaptiveBlock::Cache == strategy)
+	{
+		return aBlock->cachedRows(aSql);
+	}
+
+	if (AdaptiveBlock::PerRow == strategy)
+	{
+		return nullptr;
+	}
+
+	QString keyVariable = aBlock->getKeyVariable();
+	QString key = QString(replacements.value(keyVariable));
+
+	if (AdaptiveBlock::Preload == strategy && !aBlock->isLoaded())
+	{
+		QElapsedTimer t;
+		t.start();
+		addUsage(currentTemplateBlockName, 0, 1, 0);
+		if (aBlock->preload(blockDatabase(aBlock->getName()), replaceLine(aBlock->getBaseSql(), 0, false, false)))
+		{
+			logger->debugMsg(tr("block %1 preloaded in %2 ms").arg(aBlock->getName()).arg(t.elapsed()));
+		}
+		else
+		{
+			if (!aBlock->getLastError().isEmpty())
+			{
+				logger->errorMsg(aBlock->getLastError());
+			}
+			logger->infoMsg(tr("block %1 uses strategy %2: %3")
+							.arg(aBlock->getName(), AdaptiveBlock::strategyName(aBlock->getStrategy()), aBlock->getReason()));
+			return adaptiveRows(aBlock, aSql);
+		}
+	}
+
+	RowSource *rows = aBlock->cachedRows(key);
+	if (nullptr == rows && AdaptiveBlock::InList == aBlock->getStrategy())
+	{
+		// the keys of the following rows of the block which sets the key variable
+		QStringList keys;
+		keys << key;
+		for (qsizetype i = frames.size() - 1; i >= 0; --i)
+		{
+			RowSource *s = frames.at(i)->source;
+			qint32 idx = -1;
+			for (qint32 c = 0; nullptr != s && idx < 0 && c < s->count(); ++c)
+			{
+				if (s->fieldName(c) == keyVariable) idx = c;
+			}
+			if (idx >= 0)
+			{
+				foreach (const RowSource::Row &r, s->lookahead(aBlock->getBatchSize()))
+				{
+					qint32 ri = static_cast<qint32>(r.fields.indexOf(keyVariable));
+					QString k = ri >= 0 ? r.values.at(ri).toString() : QString("");
+					if (ri >= 0 && !keys.contains(k)) keys << k;
 				}
+				break;
+			}
+		}
+
+		addUsage(currentTemplateBlockName, 0, 1, 0);
+		if (aBlock->fetchKeys(blockDatabase(aBlock->getName()), replaceLine(aBlock->getBaseSql(), 0, false, false), keys))
+		{
+			rows = aBlock->cachedRows(key);
+		}
+		else
+		{
+			logger->errorMsg(aBlock->getLastError());
+			logger->infoMsg(tr("block %1 uses strategy %2: %3")
+							.arg(aBlock->getName(), AdaptiveBlock::strategyName(aBlock->getStrategy()), aBlock->getReason()));
+		}
+	}
+
+	return rows;
+}
+
+//! \return the innermost frame with rows, which contains the field at the current
+//! row (every field for an empty name) or nullptr
+QueryExecutor::TemplateFrame *QueryExecutor::dataFrame(const QString &aField) const
+{
+	for (qsizetype i = frames.size() - 1; i >= 0; --i)
+	{
+		TemplateFrame *f = frames.at(i);
+		if (nullptr != f->source && (aField.isEmpty() || f->source->row().fields.contains(aField)))
+		{
+			return f;
+		}
+	}
+
+	return nullptr;
+}
+
+//! The values of the rows are escaped for XML output, binary values are
+//! encoded or written to a file from the unchanged column value.
+//! \return the column value of the current row or the given value
+QByteArray QueryExecutor::rawValue(const QString &aField, const QByteArray &aValue) const
+{
+	TemplateFrame *f = mQSE->getOutputXml() ? dataFrame(aField) : nullptr;
+	if (nullptr == f)
+	{
+		return aValue;
+	}
+
+	QByteArray raw = f->source->row().values.at(f->source->row().fields.indexOf(aField)).toByteArray();
+	QByteArray escaped(raw);
+	escaped.replace("<", "&lt;");
+	escaped.replace(">","&gt;");
+
+	// the replacement can be a value of another source with the same name
+	return escaped == aValue ? raw : aValue;
+}
 
-				if (empty)
+//! Read the field of the previous row or of the next row, the next row is
+//! read into the lookahead buffer of the source and no extra query is needed.
+//! \return false if there is no such row
+bool QueryExecutor::neighbourValue(const QString &aField, bool aNext, QByteArray &aValue)
+{
+	TemplateFrame *f = dataFrame(aField);
+	if (nullptr == f)
+	{
+		return false;
+	}
+
+	RowSource::Row r;
+	if (aNext)
+	{
+		if (f->rowLimit > 0 && f->rowCount >= static_cast<quint64>(f->rowLimit))
+		{
+			return false;
+		}
+		const QList<RowSource::Row> &next = f->source->lookahead(1);
+		if (next.isEmpty())
+		{
+			return false;
+		}
+		r = next.first();
+	}
+	else
+	{
+		r = f->previousRow;
+	}
+
+	qsizetype idx = r.fields.indexOf(aField);
+	if (idx < 0)
+	{
+		return false;
+	}
+
+	aValue = r.values.at(idx).toByteArray();
+	if (mQSE->getOutputXml())
+	{
+		aValue.replace("<", "&lt;");
+		aValue.replace(">","&gt;");
+	}
+
+	return true;
+}
+
+//! Return the rows of a #{NAME,MERGE,parentkey[,childkey]} call. The child query
+//! is executed once for the calling block ordered by the key, a key filter
+//! WHERE <column> = ${<var>} at the end of the query is removed.
+//! \return nullptr if the query fails
+RowSource *QueryExecutor::mergeRows(const QString &aQueryName, const QString &aParentKey, const QString &aChildKey)
+{
+	TemplateFrame *caller = dataFrame(aParentKey);
+	if (nullptr == caller)
+	{
+		logger->errorMsg(tr("MERGE of %1 needs a calling block with the column %2").arg(aQueryName, aParentKey));
+		return nullptr;
+	}
+
+	MergeCursor *mc = caller->merges.value(aQueryName, nullptr);
+	if (nullptr == mc)
+	{
+		QString sql = queriesMap[aQueryName];
+		QString baseSql, column, variable;
+		if (AdaptiveBlock::splitKeyFilter(sql, baseSql, column, variable))
+		{
+			sql = baseSql;
+		}
+		sql = replaceLine(sql, 0, false, false);
+		logger->debugMsg(tr("SQL-Query for merge on %1: %2").arg(aChildKey, sql));
+
+		mc = new MergeCursor(blockDatabase(aQueryName), sql, aChildKey);
+		caller->merges.insert(aQueryName, mc);
+		addUsage(aQueryName, 0, 1, 0);
+		if (!mc->open())
+		{
+			logger->errorMsg(tr("merge %1: %2").arg(aQueryName, mc->getLastError()));
+		}
+	}
+	if (!mc->getLastError().isEmpty())
+	{
+		return nullptr;
+	}
+
+	qsizetype idx = caller->source->row().fields.indexOf(aParentKey);
+	return new MergeRowSource(mc, caller->source->row().values.at(idx));
+}
+
+//! The database of a block declared as ::NAME@connection, the connection is
+//! opened at the first use and kept open until the end of the run. Blocks
+//! without a connection or with the connection of the query set use the
+//! default database.
+QSqlDatabase QueryExecutor::blockDatabase(const QString &aBlock)
+{
+	QString name = queryConnectionMap.value(aBlock);
+	if (name.isEmpty() || (nullptr != defaultConnection && defaultConnection->getName() == name))
+	{
+		return QSqlDatabase::database();
+	}
+
+	QString qtName = "sqlreport@" + name;
+	if (!openConnections.contains(name))
+	{
+		DbConnection *c = nullptr != connectionSet ? connectionSet->getByName(name) : nullptr;
+		openConnections.insert(name, c);
+		if (nullptr == c)
+		{
+			logger->errorMsg(tr("block %1 uses the unknown database connection '%2'").arg(aBlock, name));
+			return QSqlDatabase();
+		}
+
+		QElapsedTimer t;
+		t.start();
+		c->setLogger(logger);
+		c->setBasePath(baseDir);
+		if (c->connectDatabase(qtName, !hasStatements(name)))
+		{
+			logger->infoMsg(tr("database connection %1 (%2) opened in %3 ms")
+							.arg(name, c->getDbType()).arg(t.elapsed()));
+		}
+		else
+		{
+			logger->errorMsg(tr("can't open database connection %1 for block %2").arg(name, aBlock));
+		}
+	}
+	if (nullptr == openConnections.value(name))
+	{
+		return QSqlDatabase();
+	}
+
+	return QSqlDatabase::database(qtName, false);
+}
+
+//! The database type of the block connection for the SQL dialect.
+QString QueryExecutor::blockDbType(const QString &aBlock) const
+{
+	DbConnection *c = openConnections.value(queryConnectionMap.value(aBlock), nullptr);
+
+	return nullptr != c ? c->getDbType() : databaseType;
+}
+
+//! Close all additional connections opened by this run.
+void QueryExecutor::closeConnections()
+{
+	QMapIterator<QString, DbConnection*> it(openConnections);
+	while (it.hasNext())
+	{
+		it.next();
+		if (nullptr != it.value())
+		{
+			it.value()->closeDatabase("sqlreport@" + it.key());
+			QueryThrottle::detach("sqlreport@" + it.key(), it.value()->getThrottle());
+		}
+	}
+	openConnections.clear();
+}
+
+//! Open the recording of the query set, the record mode "record" saves the
+//! rows of all queries and "replay" reads them without a database connection.
+//! \return false if the recording can't be opened
+bool QueryExecutor::openRecorder(const QString &basePath, const QString &aDbType)
+{
+	QString mode = mQSE->getRecordMode().trimmed().toUpper();
+	if (mode.isEmpty() || "NO" == mode)
+	{
+		return true;
+	}
+	if (("RECORD" != mode && "REPLAY" != mode) || mQSE->getRecordFile().isEmpty())
+	{
+		logger->errorMsg(tr("unknown record mode '%1' or missing record file").arg(mQSE->getRecordMode()));
+		return false;
+	}
+
+	QString fileName = QDir(basePath).absoluteFilePath(mQSE->getRecordFile());
+	recorder = new QueryRecorder(fileName, "RECORD" == mode ? QueryRecorder::Record : QueryRecorder::Replay);
+	if (!recorder->open(aDbType))
+	{
+		logger->errorMsg(tr("recording: %1").arg(recorder->getLastError()));
+		delete recorder;
+		recorder = nullptr;
+		return false;
+	}
+	logger->infoMsg(tr("%1 run using %2").arg("RECORD" == mode ? tr("record") : tr("replay"), fileName));
+
+	return true;
+}
+
+void QueryExecutor::closeRecorder()
+{
+	if (nullptr != recorder)
+	{
+		if (!recorder->getLastError().isEmpty())
+		{
+			logger->warnMsg(tr("recording: %1").arg(recorder->getLastError()));
+		}
+		logger->infoMsg(recorder->statistics());
+		delete recorder;
+		recorder = nullptr;
+	}
+}
+
+bool QueryExecutor::isReplay() const
+{
+	return nullptr != recorder && QueryRecorder::Replay == recorder->getMode();
+}
+
+//! A block with only literal text and plain column references ${Name} can
+//! be rendered by the database, every row of the query is a finished line.
+//! Modifiers, globals, nested calls and XML output need the client.
+//! \return the rendering query or an empty string
+QString QueryExecutor::renderedQuery(const QString &aQueryName, const QString &aSql,
+									 const QStringList *aLines, bool &aLinefeed) const
+{
+	static const QRegularExpression plainVariable("\\$\\{([A-Za-z_][A-Za-z0-9_]*)\\}");
+
+	if (nullptr == aLines || mQSE->getOutputXml())
+	{
+		return QString("");
+	}
+
+	QStringList texts;
+	QStringList columns;
+	QString text;
+	aLinefeed = false;
+	for (qsizetype i = 0; i < aLines->size(); ++i)
+	{
+		QString line = aLines->at(i);
+		bool joined = line.endsWith('\\');
+		if (joined) line.chop(1);
+
+		qsizetype lpos = 0;
+		QRegularExpressionMatchIterator it = plainVariable.globalMatch(line);
+		while (it.hasNext())
+		{
+			QRegularExpressionMatch m = it.next();
+			QString literal = line.mid(lpos, m.capturedStart() - lpos);
+			if (literal.contains("${") || literal.contains("#{") || m.captured(1).startsWith("__"))
+			{
+				return QString("");
+			}
+			texts << text + literal;
+			text.clear();
+			columns << m.captured(1);
+			lpos = m.capturedEnd();
+		}
+		QString literal = line.mid(lpos);
+		if (literal.contains("${") || literal.contains("#{"))
+		{
+			return QString("");
+		}
+		text += literal;
+
+		// the last linefeed is written before the next row like at the template output
+		if (i + 1 < aLines->size() && !joined)
+		{
+			text += '\n';
+		}
+		aLinefeed = !joined;
+	}
+	texts << text;
+
+	return SqlDialect::renderQuery(blockDbType(aQueryName), aSql, texts, columns);
+}
+
+//! The block with the option ::NAME,RESULTS,block1;block2;... returns a
+//! result set for every named block.
+//! \return the name of the RESULTS block or an empty string
+QString QueryExecutor::resultSetBlock(const QString &aQueryName) const
+{
+	QMapIterator<QString, QStringList> it(queryOptionsMap);
+	while (it.hasNext())
+	{
+		it.next();
+		if (it.value().size() > 1 && "RESULTS" == it.value().at(0))
+		{
+			foreach (const QString &b, it.value().at(1).split(';'))
+			{
+				if (b.trimmed() == aQueryName)
 				{
-					outputTemplate(aTemplate+"_EMPTY");
+					return it.key();
 				}
-				else
+			}
+		}
+	}
+
+	return QString("");
+}
+
+//! Execute the query of a RESULTS block and keep every result set for the
+//! matching block. If the driver supports multiple result sets the query
+//! is sent in one round trip (a batch or a procedure call), otherwise the
+//! statements are executed one after the other. Statements without a
+//! result set (e.g. SET NOCOUNT ON) are skipped. The unread result sets of
+//! an earlier read with other variable values are dropped.
+//! \return false if a statement fails
+bool QueryExecutor::loadResultSets(const QString &aResultBlock, const QString &aSql)
+{
+	QStringList blocks = queryOptionsMap.value(aResultBlock).value(1).split(';', Qt::SkipEmptyParts);
+	foreach (const QString &b, blocks)
+	{
+		resultSets.remove(b.trimmed());
+	}
+	resultSetSql.remove(aResultBlock);
+
+	QSqlDatabase db = blockDatabase(aResultBlock);
+	bool multiple = db.driver()->hasFeature(QSqlDriver::MultipleResultSets);
+	QStringList statements = multiple ? QStringList(aSql) : SqlDialect::splitStatements(aSql);
+
+	QElapsedTimer t;
+	t.start();
+	qsizetype resultCount = 0;
+	foreach (const QString &stmt, statements)
+	{
+		QSqlQuery q(db);
+		q.setForwardOnly(true);
+		bool ok = false;
+		{
+			ThrottleGuard guard(db);
+			ok = q.exec(stmt);
+		}
+		addUsage(aResultBlock, 0, 1, 0);
+		if (!ok)
+		{
+			logger->errorMsg(tr("executing SQL '%1' (%2)").arg(stmt, q.lastError().text()));
+			return false;
+		}
+
+		do
+		{
+			if (!q.isSelect())
+			{
+				continue;
+			}
+
+			QList<RowSource::Row> rows;
+			QSqlRecord rec = q.record();
+			QStringList fieldNames;
+			for (int i = 0; i < rec.count(); ++i)
+			{
+				fieldNames << rec.fieldName(i);
+			}
+			while (q.next())
+			{
+				RowSource::Row row;
+				row.fields = fieldNames;
+				for (int i = 0; i < fieldNames.size(); ++i)
 				{
-					// add the deferred linefeed from the last replaceTemplate call
-					if (lastReplaceLinefeed)
-					{
-						streamOut << "\n";
-					}
+					row.values << q.value(i);
 				}
+				rows << row;
 			}
-			else
+			if (resultCount < blocks.size())
 			{
-				QString errText = query.lastError().text();
-				streamOut << "## error executing " << sqlQuery << " ## " << errText << "##";
-                logger->errorMsg(tr("executing SQL '%1' (%2)").arg(sqlQuery, errText));
+				resultSets[blocks.at(resultCount).trimmed()] = rows;
 			}
+			resultCount++;
+		} while (multiple && q.nextResult());
+	}
+
+	resultSetSql[aResultBlock] = aSql;
+	if (resultCount != blocks.size())
+	{
+		logger->warnMsg(tr("block %1 returns %2 result sets for %3 blocks")
+						.arg(aResultBlock).arg(resultCount).arg(blocks.size()));
+	}
+	logger->debugMsg(tr("%1 result sets of %2 read in %3 ms using %4 round trips")
+					 .arg(resultCount).arg(aResultBlock).arg(t.elapsed()).arg(statements.size()));
+
+	return true;
+}
+
+//! Count the resources used by a block and for the whole run.
+void QueryExecutor::addUsage(const QString &aBlock, quint64 aRows, quint64 aQueries, quint64 aOutput)
+{
+	ResourceUsage &u = blockUsage[aBlock];
+	u.rows += aRows;
+	u.queries += aQueries;
+	u.output += aOutput;
+	totalUsage.rows += aRows;
+	totalUsage.queries += aQueries;
+	totalUsage.output += aOutput;
+}
+
+//! Compare the used resources with the limits of the query set, a limit
+//! of 0 is unlimited. If a limit is exceeded the blocks with the highest
+//! usage are logged.
+//! \return false if the run must be aborted
+bool QueryExecutor::checkBudget()
+{
+	QString limitName("");
+	qint64 limit = 0;
+	quint64 ResourceUsage::*usage = nullptr;
+
+	if (mQSE->getMaxRows() > 0 && totalUsage.rows > static_cast<quint64>(mQSE->getMaxRows()))
+	{
+		limitName = "maxRows";
+		limit = mQSE->getMaxRows();
+		usage = &ResourceUsage::rows;
+	}
+	else if (mQSE->getMaxQueries() > 0 && totalUsage.queries > static_cast<quint64>(mQSE->getMaxQueries()))
+	{
+		limitName = "maxQueries";
+		limit = mQSE->getMaxQueries();
+		usage = &ResourceUsage::queries;
+	}
+	else if (mQSE->getMaxOutputBytes() > 0 && totalUsage.output > static_cast<quint64>(mQSE->getMaxOutputBytes()))
+	{
+		limitName = "maxOutputBytes";
+		limit = mQSE->getMaxOutputBytes();
+		usage = &ResourceUsage::output;
+	}
+	else if (mQSE->getMaxSeconds() > 0 && runTimer.elapsed() > 1000LL * mQSE->getMaxSeconds())
+	{
+		limitName = "maxSeconds";
+		limit = mQSE->getMaxSeconds();
+	}
+
+	if (limitName.isEmpty())
+	{
+		return true;
+	}
+
+	QStringList stack;
+	foreach (TemplateFrame *f, frames)
+	{
+		stack << f->templateName;
+	}
+	logger->errorMsg(tr("report aborted, the limit %1=%2 is exceeded at %3")
+					 .arg(limitName).arg(limit).arg(stack.join(" > ")));
+
+	if (nullptr != usage)
+	{
+		QList<QPair<quint64, QString> > blocks;
+		QHashIterator<QString, ResourceUsage> it(blockUsage);
+		while (it.hasNext())
+		{
+			it.next();
+			blocks << qMakePair(it.value().*usage, it.key());
 		}
-		else
+		std::sort(blocks.begin(), blocks.end(), std::greater<QPair<quint64, QString> >());
+
+		QStringList top;
+		for (qsizetype i = 0; i < blocks.size() && i < 3; ++i)
 		{
-			// a standalone template without new data, at this position we
-			// can ignore the return value, because a not data driven template
-			// can't create a list.
-			(void) replaceTemplate(templLines, lineCnt);
+			top << QString("%1 (%2)").arg(blocks.at(i).second).arg(blocks.at(i).first);
 		}
+		logger->errorMsg(tr("%1 used by %2").arg(limitName, top.join(", ")));
 	}
-	else
+
+	limitExceeded = true;
+	return false;
+}
+
+//! Remove the top frame and restore the overwritten replacements.
+void QueryExecutor::popTemplate()
+{
+	TemplateFrame *f = frames.takeLast();
+
+	QHashIterator<QString, MergeCursor*> mit(f->merges);
+	while (mit.hasNext())
 	{
-		if (!aTemplate.endsWith("_EMPTY"))
+		mit.next();
+		logger->debugMsg(mit.value()->statistics());
+		if (mit.value()->isUnordered())
 		{
-            logger->errorMsg(tr("template %1 isn't defined").arg(aTemplate));
+			logger->warnMsg(tr("merge %1: the block %2 isn't ordered by the key, child rows are lost")
+							.arg(mit.key(), f->templateName));
 		}
 	}
 
-	//! last action is to restore the overwritten replacements
-    QHashIterator<QString,QByteArray> it(overwrittenReplacements);
+    QHashIterator<QString,QByteArray> it(f->overwrittenReplacements);
 	while (it.hasNext())
 	{
 		it.next();
 		replacements[it.key()] = it.value();
 	}
 
-    currentTemplateBlockName = lastTemplateName;
-    logger->setContext(currentTemplateBlockName);
+	delete f;
+}
 
-	return bRet;
+//! Every nested query holds an open cursor at the database. If there are more
+//! open cursors than the cursor budget allows, the remaining rows of the
+//! outer queries are read into memory and their cursors are closed. We start
+//! with the innermost outer frame, because the first frame is mostly the
+//! largest result.
+void QueryExecutor::limitOpenCursors()
+{
+	qint32 budget = mQSE->getCursorBudget();
+	if (budget <= 0)
+	{
+		return;
+	}
+
+	qint32 openCursors = 0;
+	foreach (TemplateFrame *f, frames)
+	{
+		if (nullptr != f->source && f->source->holdsCursor()) openCursors++;
+	}
+
+	for (qsizetype i = frames.size() - 2; openCursors > budget && i >= 0; --i)
+	{
+		RowSource *s = frames.at(i)->source;
+		if (nullptr != s && s->holdsCursor())
+		{
+			s->releaseCursor();
+			openCursors--;
+			logger->debugMsg(tr("cursor budget %1 reached, rows of template %2 buffered")
+							 .arg(budget).arg(frames.at(i)->templateName));
+		}
+	}
+}
+
+//! With maxConcurrentQueries every open cursor of a connection holds a slot.
+//! The executor can't wait for its own cursors, so before a new query of
+//! the connection the remaining rows of the other blocks are read into
+//! memory until a slot is free.
+void QueryExecutor::freeThrottleSlots(const QSqlDatabase &aDb)
+{
+	QueryThrottle *t = QueryThrottle::forConnection(aDb.connectionName());
+
+	for (qsizetype i = frames.size() - 1; nullptr != t && !t->hasFreeSlot() && i >= 0; --i)
+	{
+		RowSource *s = frames.at(i)->source;
+		if (nullptr != s && s->throttleSlot() == t && s->holdsCursor())
+		{
+			s->releaseCursor();
+			logger->debugMsg(tr("maxConcurrentQueries of the connection reached, rows of template %1 buffered")
+							 .arg(frames.at(i)->templateName));
+		}
+	}
+}
+
+//! Start one read only transaction used by all queries of the report. This
+//! gives a consistent view at the data and the database locks are taken once.
+//! The isolation level and the read only hint are set if the database knows it.
+//! \return true if a transaction is started
+bool QueryExecutor::beginSnapshot()
+{
+    if (!mQSE->getSnapshot())
+    {
+        return false;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database();
+    if (!db.driver()->hasFeature(QSqlDriver::Transactions))
+    {
+        logger->warnMsg(tr("database %1 doesn't support transactions, no snapshot used").arg(databaseType));
+        return false;
+    }
+
+    if (mQSE->getExecuteOutput())
+    {
+        logger->warnMsg(tr("the output is executed at the report database, no snapshot used"));
+        return false;
+    }
+
+    QString level = mQSE->getIsolationLevel().toUpper();
+    QSqlQuery q(db);
+    bool b = true;
+
+    if ("QMYSQL" == databaseType || "QMARIADB" == databaseType)
+    {
+        // the characteristics are set before the transaction starts
+        b = q.exec(QString("SET TRANSACTION ISOLATION LEVEL %1, READ ONLY")
+                   .arg(level.isEmpty() ? "REPEATABLE READ" : level));
+        b = b && db.transaction();
+    }
+    else if ("QODBC" == databaseType)
+    {
+        if (!level.isEmpty())
+        {
+            b = q.exec(QString("SET TRANSACTION ISOLATION LEVEL %1").arg(level));
+        }
+        b = b && db.transaction();
+    }
+    else
+    {
+        b = db.transaction();
+        if (b && "QPSQL" == databaseType)
+        {
+            b = q.exec(QString("SET TRANSACTION ISOLATION LEVEL %1 READ ONLY")
+                       .arg(level.isEmpty() ? "REPEATABLE READ" : level));
+        }
+        else if (b && "QOCI" == databaseType)
+        {
+            b = q.exec(level.isEmpty() ? QString("SET TRANSACTION READ ONLY")
+                                       : QString("SET TRANSACTION ISOLATION LEVEL %1").arg(level));
+        }
+        if (!b)
+        {
+            db.rollback();
+        }
+    }
+
+    if (!b)
+    {
+        QString errText = q.lastError().isValid() ? q.lastError().text() : db.lastError().text();
+        logger->warnMsg(tr("can't start snapshot transaction, using autocommit (%1)").arg(errText));
+        return false;
+    }
+
+    logger->infoMsg(tr("report runs in a read only transaction %1").arg(level));
+    return true;
 }
 
+//! Finish the snapshot transaction, nothing is changed so the commit
+//! only releases the locks.
+void QueryExecutor::endSnapshot()
+{
+    QSqlDatabase db = QSqlDatabase::database();
+    if (!db.commit())
+    {
+        logger->warnMsg(tr("closing snapshot transaction (%1)").arg(db.lastError().text()));
+        db.rollback();
+    }
+}
 
 bool QueryExecutor::createOutput(QuerySetEntry *aQSE,
 								 DbConnection *dbc,
@@ -1287,15 +2857,39 @@ bool QueryExecutor::createOutput(QuerySetEntry *aQSE,
     QElapsedTimer t;
 	t.start();
 
+	limitExceeded = false;
+	blockUsage.clear();
+	totalUsage = ResourceUsage();
+	runTimer.start();
+	watermarkMax = QVariant();
 	clearStructures();								// remove the internal structure
+	if (previewRun)
+	{
+		logger->infoMsg(tr("preview run, every block outputs up to %1 rows").arg(previewRows));
+	}
     logger->cleanMessageHash();                     // clean the logger message cache, restarts with execute
 	setInputValues(inputDefines);                   // set the input parameters from (input defines and local definese)
 	createOutputFileName(basePath);                 // create variable mOutFileName
 	createInputFileNames(basePath);					// create absolute input file names
-	if (nullptr != dbc)
+	defaultConnection = dbc;
+	baseDir = basePath;
+	bool recording = openRecorder(basePath, nullptr != dbc ? dbc->getDbType() : QString(""));
+	bool parsed = readSqlFile();                    // read the sql blocks into the internal structure
+	if (isReplay())
+	{
+		databaseType = recorder->getDbType();
+		if (nullptr != dbc)
+		{
+			replacements["_tableprefix"] = QByteArray(dbc->getTablePrefix().toUtf8());
+		}
+	}
+	else if (nullptr != dbc)
 	{
         dbc->setLogger(logger);
-		b = dbc->connectDatabase();                 // connect to database and set _tableprefix
+        dbc->setBasePath(basePath);
+		// a report without statements to execute can read from a replica
+		b = dbc->connectDatabase(QString(QSqlDatabase::defaultConnection),
+								 !mQSE->getExecuteOutput() && !hasStatements(QString("")));
 		if (b)
 		{
             replacements["_tableprefix"] = QByteArray(dbc->getTablePrefix().toUtf8());
@@ -1312,17 +2906,89 @@ bool QueryExecutor::createOutput(QuerySetEntry *aQSE,
         }
 	}
 
-	b = b && executeInputFiles();                   // read the sql and the template file into the internal structure
+	b = b && recording && parsed;                   // a replay run reads the recorded rows
+	quint64 throttledNanos = nullptr != dbc ? dbc->getThrottle()->getThrottledNanos() : 0;
+	quint64 throttledQueries = nullptr != dbc ? dbc->getThrottle()->getThrottledQueries() : 0;
+	if (b) prepareSqlQueries();
+    bool teardown = b && !isReplay();
+    // the staging tables are created before the batch device of executeOutput starts its transaction
+    b = b && (isReplay() || executeStatements("SETUP"));
+	b = b && executeInputFiles();                   // read the template file and open the output
+    bool snapshot = b && !isReplay() && beginSnapshot(); // optional read only transaction for the whole report
     b = b && outputTemplate("MAIN");				// start process with the MAIN template
+    foreach (LookupTable *lt, lookupMap)
+    {
+        logger->debugMsg(lt->statistics());
+    }
+    if (!adaptiveBlocks.isEmpty())
+    {
+        // remember the observed values for the next run
+        QMap<QString, BlockStatistic> stats = mQSE->getBlockStatistics();
+        QMapIterator<QString, AdaptiveBlock*> ait(adaptiveBlocks);
+        while (ait.hasNext())
+        {
+            ait.next();
+            stats[ait.key()] = ait.value()->statistic();
+        }
+        mQSE->setBlockStatistics(stats);
+    }
+    qDeleteAll(lookupMap);                          // release the lookup queries before closing
+    lookupMap.clear();
+    if (snapshot)
+    {
+        endSnapshot();
+    }
 	streamOut.flush();
 	fileOut.close();								// flush and close the output file
+	if (nullptr != batchOut)
+	{
+		batchOut->close();                          // execute the remaining statements
+		b = b && !batchOut->hasFailed();
+		streamOut.setDevice(nullptr);
+		delete batchOut;
+		batchOut = nullptr;
+	}
+	if (teardown)
+	{
+		b = executeStatements("TEARDOWN") && b;     // remove the staging tables
+	}
 
 	// close the database connection
 	if (nullptr != dbc)
 	{
+		throttledQueries = dbc->getThrottle()->getThrottledQueries() - throttledQueries;
+		if (throttledQueries > 0)
+		{
+			logger->infoMsg(tr("%1 queries throttled for %2")
+							.arg(throttledQueries)
+							.arg(Utility::formatMilliSeconds((dbc->getThrottle()->getThrottledNanos() - throttledNanos) / 1000000)));
+		}
 		dbc->closeDatabase();				        // close the database connection
 	}
+	closeConnections();
+	if (b && watermarkMax.isValid() && !previewRun && !isReplay())
+	{
+		// the next run starts after the last processed row, the query set is
+		// saved at once, so a crash doesn't process the same rows again
+		QString wm = watermarkMax.toString();
+		if (watermarkMax.metaType().id() == QMetaType::QDateTime || watermarkMax.metaType().id() == QMetaType::QTime)
+		{
+			// the driver converted the value, Qt keeps only milliseconds
+			wm = watermarkMax.metaType().id() == QMetaType::QTime
+					? watermarkMax.toTime().toString("HH:mm:ss.zzz")
+					: watermarkMax.toDateTime().toString("yyyy-MM-dd HH:mm:ss.zzz");
+			logger->warnMsg(tr("watermark %1 is a timestamp with millisecond precision, cast it to text at the MAIN query")
+							.arg(mQSE->getWatermarkColumn()));
+		}
+		logger->infoMsg(tr("watermark %1 advanced from '%2' to '%3'")
+						.arg(mQSE->getWatermarkColumn(), mQSE->getWatermark(), wm));
+		mQSE->setWatermark(wm);
+		emit watermarkAdvanced(mQSE);
+	}
+	closeRecorder();
 
+    logger->debugMsg(tr("used %1 rows, %2 queries and %3 output bytes")
+                     .arg(totalUsage.rows).arg(totalUsage.queries).arg(totalUsage.output));
     logger->infoMsg(tr("query execution time: %1; using %2 different parameters")
 			.arg(Utility::formatMilliSeconds(t.elapsed()))
             .arg(replacements.size()));
@@ -3,7 +3,13 @@
 
 #include <QObject>
 #include "QuerySet.h"
+#include "AdaptiveBlock.h"
 #include "DBConnection.h"
+#include "DbConnectionSet.h"
+#include "LookupTable.h"
+#include "QueryRecorder.h"
+#include "RowSource.h"
+#include "SqlBatchDevice.h"
 #include "logmessage.h"
 #include <QDateTime>
 #include <QFile>
@@ -39,18 +45,38 @@ public:
           treeReplacements(),
           cumulationMap(),
           queriesMap(),
+          queryOptionsMap(),
           preparedQueriesMap(),
           templatesMap(),
+          lookupMap(),
+          adaptiveBlocks(),
+          clientRendered(),
+          resultSets(),
+          resultSetSql(),
+          queryConnectionMap(),
+          openConnections(),
+          connectionSet(nullptr),
+          defaultConnection(nullptr),
+          recorder(nullptr),
+          baseDir(""),
           sqlFileName(""),
           templateFileName(""),
           databaseType(""),
           scriptEngine(),
           decodeDatabase(QStringDecoder(QStringDecoder::Utf8)),
           fileOut(),
+          batchOut(nullptr),
           streamOut(),
           uniqueId(0),
           firstQueryResult(false),
           prepareQueries(false),
+          previewRun(false),
+          limitExceeded(false),
+          blockUsage(),
+          totalUsage(),
+          runTimer(),
+          watermarkMax(),
+          frames(),
           currentTemplateBlockName(""),
           fontElement("<[/]*font[^>]*>"),
           spanElement("<[/]*span[^>]*>"),
@@ -69,14 +95,89 @@ public:
     }
 
 	void setPrepareQueriesFlag(bool flag);
+	void setPreviewFlag(bool flag);
+	void setConnectionSet(DbConnectionSet *aSet);
 
 	bool createOutput(QuerySetEntry *aQSE, DbConnection *dbc,
 					  const QString &basePath, const QString &inputDefines);
 
+signals:
+	//! the watermark of the query set is changed and must be saved
+	void watermarkAdvanced(QuerySetEntry *aQSE);
+
 protected:
-	bool replaceTemplate(const QStringList *aTemplLines, int aLineCnt);
+	//! The state of one template block call. All calls are kept at the heap
+	//! allocated frame stack, so deep nested templates don't use the C stack.
+	struct TemplateFrame
+	{
+		TemplateFrame()
+			: templateName(""), templLines(nullptr), source(nullptr), block(nullptr), listSeperator(""),
+			  overwrittenReplacements(), rowCount(0), previousRow(), merges(), rowLimit(0), lineCnt(0), lineIdx(0), linePos(0),
+			  lastReplaceLinefeed(false), rendered(false), renderedLinefeed(false), firstQueryResult(true), empty(true),
+			  rowActive(false), finished(false), result(true)
+		{
+		}
+		~TemplateFrame() { delete source; qDeleteAll(merges); }
+
+		QString templateName;
+		const QStringList *templLines;
+		RowSource *source;              // nullptr for a standalone template
+		AdaptiveBlock *block;           // the statistics of a nested block
+		QString listSeperator;          // used with the ,list modifier
+		QHash<QString, QByteArray> overwrittenReplacements;
+		quint64 rowCount;
+		RowSource::Row previousRow;     // the row before the current row
+		QHash<QString, MergeCursor*> merges;    // the child cursors of merge calls
+		qint32 rowLimit;                // 0 is unlimited
+		int lineCnt;
+		int lineIdx;                    // the current template line
+		qsizetype linePos;              // the position inside the current line
+		bool lastReplaceLinefeed;
+		bool rendered;                  // the rows are the finished lines
+		bool renderedLinefeed;          // the rendered lines need the deferred linefeed
+		bool firstQueryResult;
+		bool empty;
+		bool rowActive;                 // the template lines are written
+		bool finished;                  // all rows are read
+		bool result;
+
+	private:
+		Q_DISABLE_COPY(TemplateFrame)
+	};
+
+	//! The resources used by a block or the whole run.
+	struct ResourceUsage
+	{
+		ResourceUsage() : rows(0), queries(0), output(0) {}
+
+		quint64 rows;
+		quint64 queries;
+		quint64 output;                 // characters written
+	};
+
+	bool replaceTemplate(TemplateFrame *aFrame, QString &aCall);
 	QString replaceLine(const QString &aLine, int aLineCnt, bool sqlBinding, bool simpleFormat);
+	void appendEncoded(QString &result, const QByteArray &aData, bool base64) const;
+	QString writeValueToFile(const QByteArray &aData, const QString &aFileName);
+	void writeOutput(QStringView aText);
     bool outputTemplate(QString aTemplate);
+	bool pushTemplate(QString aTemplate);
+	bool nextTemplateRow(TemplateFrame *aFrame);
+	void popTemplate();
+	void limitOpenCursors();
+	void freeThrottleSlots(const QSqlDatabase &aDb);
+	TemplateFrame *dataFrame(const QString &aField) const;
+	bool neighbourValue(const QString &aField, bool aNext, QByteArray &aValue);
+	QByteArray rawValue(const QString &aField, const QByteArray &aValue) const;
+	RowSource *mergeRows(const QString &aQueryName, const QString &aParentKey, const QString &aChildKey);
+	void addUsage(const QString &aBlock, quint64 aRows, quint64 aQueries, quint64 aOutput);
+	bool checkBudget();
+	AdaptiveBlock *nestedBlock(const QString &aQueryName, const QStringList &aOptions);
+	RowSource *adaptiveRows(AdaptiveBlock *aBlock, const QString &aSql);
+	QString renderedQuery(const QString &aQueryName, const QString &aSql,
+						  const QStringList *aLines, bool &aLinefeed) const;
+	QString resultSetBlock(const QString &aQueryName) const;
+	bool loadResultSets(const QString &aResultBlock, const QString &aSql);
 	QString getDate(const QString &aFormat) const;
 	void clearStructures();
 
@@ -86,13 +187,27 @@ private:
 	void replaceLineGlobal(const QStringList &varList, QString &result, int lineCnt);
 	void showDbError(QString vErrStr);
 	bool connectDatabase();
+	bool beginSnapshot();
+	void endSnapshot();
 	void createOutputFileName(const QString &basePath);
 	void createInputFileNames(const QString &basePath);
+	bool readSqlFile();
 	bool executeInputFiles();
 	void setInputValues(const QString &inputDefines);
 	QStringList splitString(const QString &str, int width, const QString &startOfLine) const;
 	quint32 convertToNumber(QString aNumStr, bool &aOk) const;
 	void addSqlQuery(const QString &name, const QString &sqlLine);
+	void prepareSqlQueries();
+	bool hasStatements(const QString &aConnection) const;
+	bool isStatementBlock(const QString &name) const;
+	bool executeStatements(const QString &aBlock);
+	bool lookupValue(const QString &aTable, const QString &aKey, const QString &aColumn, QByteArray &aValue);
+	QSqlDatabase blockDatabase(const QString &aBlock);
+	QString blockDbType(const QString &aBlock) const;
+	void closeConnections();
+	bool openRecorder(const QString &basePath, const QString &aDbType);
+	void closeRecorder();
+	bool isReplay() const;
     QString convertRtf(QString rtfText, QString resultType, bool cleanupFont);
 
     LogMessage *logger;
@@ -103,8 +218,20 @@ private:
     QHash <QString, QByteArray> treeReplacements;
 	QMap <QString, quint32> cumulationMap;
 	QMap <QString, QString> queriesMap;
+	QMap <QString, QStringList> queryOptionsMap;
 	QMap <QString, QSqlQuery> preparedQueriesMap;
 	QMap <QString, QStringList* > templatesMap;
+	QMap <QString, LookupTable*> lookupMap;
+	QMap <QString, AdaptiveBlock*> adaptiveBlocks;
+	QSet <QString> clientRendered;      // blocks whose rendering query failed
+	QHash <QString, QList<RowSource::Row> > resultSets;  // unread result sets of RESULTS blocks
+	QHash <QString, QString> resultSetSql;               // SQL of the last read of a RESULTS block
+	QMap <QString, QString> queryConnectionMap;
+	QMap <QString, DbConnection*> openConnections;
+	DbConnectionSet *connectionSet;
+	DbConnection *defaultConnection;
+	QueryRecorder *recorder;
+	QString baseDir;                    // directory of the query set
 	QString sqlFileName;
     QString templateFileName;
     QString databaseType;
@@ -112,11 +239,19 @@ private:
     QStringDecoder decodeDatabase;
 
 	QFile fileOut;
+	SqlBatchDevice *batchOut;
 	QTextStream streamOut;
 
 	int uniqueId;
 	bool firstQueryResult;
 	bool prepareQueries;
+	bool previewRun;
+	bool limitExceeded;
+	QHash<QString, ResourceUsage> blockUsage;
+	ResourceUsage totalUsage;
+	QElapsedTimer runTimer;
+	QVariant watermarkMax;              // the highest watermark column value of the MAIN rows
+	QList<TemplateFrame*> frames;
 	QString currentTemplateBlockName;
     QRegularExpression fontElement;
     QRegularExpression spanElement;
@@ -0,0 +1,324 @@
+#include "QueryRecorder.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QtSql/QSqlError>
+
+//! A block query which is read from the database, all fetched rows are
+//! written to the recording.
+class RecordingRowSource : public RowSource
+{
+public:
+    RecordingRowSource(QueryRecorder *aRecorder, qint64 aQueryId, RowSource *aSource)
+        : RowSource(), recorder(aRecorder), queryId(aQueryId), source(aSource), pos(0)
+    {
+    }
+    ~RecordingRowSource() override { delete source; }
+
+    QString statistics() const override { return source->statistics(); }
+    bool holdsCursor() const override { return source->holdsCursor(); }
+
+protected:
+    bool fetch(Row &row) override
+    {
+        if (!source->next())
+        {
+            lastError = source->getLastError();
+            return false;
+        }
+        row = source->row();
+        recorder->addRow(queryId, pos++, row);
+        return true;
+    }
+
+    void closeCursor(QList<Row> &rows) override
+    {
+        // the rows are buffered by the source and recorded at the next fetch
+        Q_UNUSED(rows)
+        source->releaseCursor();
+    }
+
+private:
+    QueryRecorder *recorder;
+    qint64 queryId;
+    RowSource *source;
+    qint64 pos;
+};
+
+//! The recorded rows of a block query, read one by one from the file.
+class ReplayRowSource : public RowSource
+{
+public:
+    explicit ReplayRowSource(const QSqlQuery &aQuery) : RowSource(), query(aQuery) {}
+
+protected:
+    bool fetch(Row &row) override
+    {
+        return query.next() && QueryRecorder::readRow(query.value(0).toByteArray(), row);
+    }
+
+private:
+    QSqlQuery query;
+};
+
+QueryRecorder::QueryRecorder(const QString &aFileName, Mode aMode)
+    : fileName(aFileName),
+      mode(aMode),
+      connectionName(QString("sqlreport-recorder-%1").arg(reinterpret_cast<quintptr>(this))),
+      dbType(""),
+      lastError(""),
+      queryIds(),
+      lookups(),
+      insertQuery(),
+      insertRow(),
+      insertLookup(),
+      queryCount(0),
+      rowCount(0),
+      misses(0)
+{
+}
+
+QueryRecorder::~QueryRecorder()
+{
+    close();
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+//! Create a new recording or open an existing one for replay.
+//! \param aDbType the database type stored with a new recording
+//! \return false if the file can't be used
+bool QueryRecorder::open(const QString &aDbType)
+{
+    if (Record == mode && QFile::exists(fileName) && !QFile::remove(fileName))
+    {
+        lastError = QString("can't replace the recording %1").arg(fileName);
+        return false;
+    }
+    if (Replay == mode && !QFile::exists(fileName))
+    {
+        lastError = QString("recording %1 doesn't exists").arg(fileName);
+        return false;
+    }
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(fileName);
+    if (Replay == mode)
+    {
+        db.setConnectOptions("QSQLITE_OPEN_READONLY");
+    }
+    if (!db.open())
+    {
+        lastError = QString("%1 (%2)").arg(fileName, db.lastError().text());
+        return false;
+    }
+
+    if (Record == mode)
+    {
+        dbType = aDbType;
+        bool ok = exec("PRAGMA journal_mode=OFF")
+                && exec("PRAGMA synchronous=OFF")
+                && exec("CREATE TABLE meta (name TEXT PRIMARY KEY, value TEXT)")
+                && exec("CREATE TABLE queries (id INTEGER PRIMARY KEY, block TEXT, sql TEXT)")
+                && exec("CREATE TABLE rows (query_id INTEGER, pos INTEGER, data BLOB, PRIMARY KEY (query_id, pos))")
+                && exec("CREATE TABLE lookups (tbl TEXT, key TEXT, col TEXT, value BLOB, PRIMARY KEY (tbl, key, col))");
+        if (!ok)
+        {
+            return false;
+        }
+
+        QSqlQuery meta(db);
+        meta.prepare("INSERT INTO meta (name, value) VALUES (?, ?)");
+        meta.addBindValue(QVariantList() << "dbType" << "created");
+        meta.addBindValue(QVariantList() << dbType << QDateTime::currentDateTime().toString(Qt::ISODate));
+        meta.execBatch();
+
+        insertQuery = QSqlQuery(db);
+        insertQuery.prepare("INSERT INTO queries (block, sql) VALUES (?, ?)");
+        insertRow = QSqlQuery(db);
+        insertRow.prepare("INSERT INTO rows (query_id, pos, data) VALUES (?, ?, ?)");
+        insertLookup = QSqlQuery(db);
+        insertLookup.prepare("INSERT OR REPLACE INTO lookups (tbl, key, col, value) VALUES (?, ?, ?, ?)");
+
+        // a single transaction for the whole recording
+        db.transaction();
+        return true;
+    }
+
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    if (q.exec("SELECT value FROM meta WHERE name = 'dbType'") && q.next())
+    {
+        dbType = q.value(0).toString();
+    }
+    if (!q.exec("SELECT id, block, sql FROM queries"))
+    {
+        lastError = QString("%1 isn't a recording (%2)").arg(fileName, q.lastError().text());
+        return false;
+    }
+    while (q.next())
+    {
+        queryIds.insert(q.value(1).toString() + '\n' + q.value(2).toString(), q.value(0).toLongLong());
+    }
+    if (q.exec("SELECT tbl, key, col, value FROM lookups"))
+    {
+        while (q.next())
+        {
+            RowSource::Row r;
+            readRow(q.value(3).toByteArray(), r);
+            lookups.insert(QStringList({q.value(0).toString(), q.value(1).toString(), q.value(2).toString()}).join('\n'),
+                           r.values.value(0));
+        }
+    }
+
+    return true;
+}
+
+void QueryRecorder::close()
+{
+    QSqlDatabase db = QSqlDatabase::database(connectionName, false);
+    if (db.isOpen())
+    {
+        insertQuery = QSqlQuery();
+        insertRow = QSqlQuery();
+        insertLookup = QSqlQuery();
+        if (Record == mode)
+        {
+            db.commit();
+        }
+        db.close();
+    }
+}
+
+bool QueryRecorder::exec(const QString &aSql)
+{
+    QSqlQuery q(QSqlDatabase::database(connectionName, false));
+    if (!q.exec(aSql))
+    {
+        lastError = QString("%1 (%2)").arg(aSql, q.lastError().text());
+        return false;
+    }
+
+    return true;
+}
+
+//! Record the rows of the source, a query already recorded by an earlier
+//! call isn't recorded again.
+//! \return the source reading the rows, the recorder takes the ownership of aSource
+RowSource *QueryRecorder::record(const QString &aBlock, const QString &aSql, RowSource *aSource)
+{
+    QString key = aBlock + '\n' + aSql;
+    if (nullptr == aSource || queryIds.contains(key))
+    {
+        return aSource;
+    }
+
+    insertQuery.addBindValue(aBlock);
+    insertQuery.addBindValue(aSql);
+    if (!insertQuery.exec())
+    {
+        lastError = insertQuery.lastError().text();
+        return aSource;
+    }
+    qint64 id = insertQuery.lastInsertId().toLongLong();
+    queryIds.insert(key, id);
+    queryCount++;
+
+    return new RecordingRowSource(this, id, aSource);
+}
+
+//! \return the recorded rows of the query or nullptr if it isn't recorded
+RowSource *QueryRecorder::replay(const QString &aBlock, const QString &aSql)
+{
+    qint64 id = queryIds.value(aBlock + '\n' + aSql, -1);
+    if (id < 0)
+    {
+        misses++;
+        return nullptr;
+    }
+
+    QSqlQuery q(QSqlDatabase::database(connectionName, false));
+    q.setForwardOnly(true);
+    q.prepare("SELECT data FROM rows WHERE query_id = ? ORDER BY pos");
+    q.addBindValue(id);
+    if (!q.exec())
+    {
+        lastError = q.lastError().text();
+        return nullptr;
+    }
+    queryCount++;
+
+    return new ReplayRowSource(q);
+}
+
+void QueryRecorder::recordLookup(const QString &aTable, const QString &aKey, const QString &aColumn, const QVariant &aValue)
+{
+    QString key = QStringList({aTable, aKey, aColumn}).join('\n');
+    if (lookups.contains(key))
+    {
+        return;
+    }
+    lookups.insert(key, aValue);
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << QStringList() << (QVariantList() << aValue);
+
+    insertLookup.addBindValue(aTable);
+    insertLookup.addBindValue(aKey);
+    insertLookup.addBindValue(aColumn);
+    insertLookup.addBindValue(data);
+    insertLookup.exec();
+}
+
+//! \return false if the lookup wasn't recorded or has no value
+bool QueryRecorder::replayLookup(const QString &aTable, const QString &aKey, const QString &aColumn, QVariant &aValue) const
+{
+    QString key = QStringList({aTable, aKey, aColumn}).join('\n');
+    if (!lookups.contains(key))
+    {
+        return false;
+    }
+
+    aValue = lookups.value(key);
+    return true;
+}
+
+bool QueryRecorder::addRow(qint64 aQueryId, qint64 aPos, const RowSource::Row &aRow)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << aRow.fields << aRow.values;
+
+    insertRow.addBindValue(aQueryId);
+    insertRow.addBindValue(aPos);
+    insertRow.addBindValue(data);
+    if (!insertRow.exec())
+    {
+        lastError = insertRow.lastError().text();
+        return false;
+    }
+    rowCount++;
+
+    return true;
+}
+
+bool QueryRecorder::readRow(const QByteArray &aData, RowSource::Row &aRow)
+{
+    QDataStream in(aData);
+    in >> aRow.fields >> aRow.values;
+
+    return QDataStream::Ok == in.status();
+}
+
+QString QueryRecorder::statistics() const
+{
+    if (Record == mode)
+    {
+        return QString("recorded %1 queries with %2 rows and %3 lookups to %4")
+                .arg(queryCount).arg(rowCount).arg(lookups.size()).arg(fileName);
+    }
+
+    return QString("replayed %1 queries from %2, %3 queries not recorded")
+            .arg(queryCount).arg(fileName).arg(misses);
+}
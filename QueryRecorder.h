@@ -0,0 +1,60 @@
+#ifndef QUERYRECORDER_H
+#define QUERYRECORDER_H
+
+#include "RowSource.h"
+
+#include <QHash>
+#include <QString>
+#include <QVariant>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+//! Saves the rows of every block query of a run into a local SQLite file
+//! and serves them in a later run without a database connection. A query
+//! is identified by the block name and the SQL text with all variables
+//! replaced, every row is stored as a serialized list of names and values.
+class QueryRecorder
+{
+public:
+    enum Mode { Record, Replay };
+
+    QueryRecorder(const QString &aFileName, Mode aMode);
+    ~QueryRecorder();
+
+    bool open(const QString &aDbType);
+    void close();
+
+    Mode getMode() const { return mode; }
+    QString getDbType() const { return dbType; }
+    QString getLastError() const { return lastError; }
+    QString statistics() const;
+
+    RowSource *record(const QString &aBlock, const QString &aSql, RowSource *aSource);
+    RowSource *replay(const QString &aBlock, const QString &aSql);
+    void recordLookup(const QString &aTable, const QString &aKey, const QString &aColumn, const QVariant &aValue);
+    bool replayLookup(const QString &aTable, const QString &aKey, const QString &aColumn, QVariant &aValue) const;
+
+    bool addRow(qint64 aQueryId, qint64 aPos, const RowSource::Row &aRow);
+    static bool readRow(const QByteArray &aData, RowSource::Row &aRow);
+
+private:
+    Q_DISABLE_COPY(QueryRecorder)
+
+    bool exec(const QString &aSql);
+
+    QString fileName;
+    Mode mode;
+    QString connectionName;
+    QString dbType;
+    QString lastError;
+    QHash<QString, qint64> queryIds;
+    QHash<QString, QVariant> lookups;
+    QSqlQuery insertQuery;
+    QSqlQuery insertRow;
+    QSqlQuery insertLookup;
+    quint64 queryCount;
+    quint64 rowCount;
+    quint64 misses;
+};
+
+#endif // QUERYRECORDER_H
@@ -172,6 +172,38 @@ bool QuerySet::readXml(QString aFilename, DbConnectionSet &dbSet)
 							if (ce == "UTF8")         { vQEntry->setOutputUtf8((te.toUpper()=="YES")); }
 							if (ce == "ASXML")        { vQEntry->setOutputXml((te.toUpper()=="YES")); }
                             if (ce == "SHOWFIRST")    { vQEntry->setShowFirst((te.toUpper()=="YES")); }
+                            if (ce == "EXECUTEOUTPUT") { vQEntry->setExecuteOutput((te.toUpper()=="YES")); }
+                            if (ce == "TRANSACTIONSIZE") { vQEntry->setTransactionSize(te.toInt()); }
+                            if (ce == "SNAPSHOT")     { vQEntry->setSnapshot((te.toUpper()=="YES")); }
+                            if (ce == "ISOLATIONLEVEL") { vQEntry->setIsolationLevel(te.trimmed()); }
+                            if (ce == "MAXDEPTH")     { vQEntry->setMaxDepth(te.toInt()); }
+                            if (ce == "CURSORBUDGET") { vQEntry->setCursorBudget(te.toInt()); }
+                            if (ce == "MAXROWS")      { vQEntry->setMaxRows(te.toLongLong()); }
+                            if (ce == "MAXQUERIES")   { vQEntry->setMaxQueries(te.toLongLong()); }
+                            if (ce == "MAXOUTPUTBYTES") { vQEntry->setMaxOutputBytes(te.toLongLong()); }
+                            if (ce == "MAXSECONDS")   { vQEntry->setMaxSeconds(te.toInt()); }
+                            if (ce == "RECORDMODE")   { vQEntry->setRecordMode(te.trimmed()); }
+                            if (ce == "RECORDFILE")   { vQEntry->setRecordFile(te.trimmed()); }
+                            if (ce == "WATERMARKCOLUMN") { vQEntry->setWatermarkColumn(te.trimmed()); }
+                            if (ce == "WATERMARK")    { vQEntry->setWatermark(te); }
+                            if (ce == "PUSHDOWNRENDER") { vQEntry->setPushdownRender((te.toUpper()=="YES")); }
+                            if (ce == "BLOCKSTATISTICS")
+                            {
+                                QMap<QString, BlockStatistic> stats;
+                                QDomElement be = cn.firstChildElement("block");
+                                while (!be.isNull())
+                                {
+                                    BlockStatistic bs;
+                                    bs.calls     = be.attribute("calls").toULongLong();
+                                    bs.rows      = be.attribute("rows").toULongLong();
+                                    bs.distinct  = be.attribute("distinct").toULongLong();
+                                    bs.nanos     = be.attribute("nanos").toULongLong();
+                                    bs.tableRows = be.attribute("tableRows").toULongLong();
+                                    stats[be.attribute("name")] = bs;
+                                    be = be.nextSiblingElement("block");
+                                }
+                                vQEntry->setBlockStatistics(stats);
+                            }
 							cn = cn.nextSibling();
 						}
 						if ( !vQEntry->getName().isEmpty() )
@@ -239,11 +271,44 @@ void QuerySet::writeXml(QString aFileName, DbConnectionSet &dbSet) const
 			vStream.writeTextElement("template",	 qse->getTemplateFile() );
 			vStream.writeTextElement("output",		 qse->getOutputFile());
 			vStream.writeTextElement("batchrun",     qse->getBatchrun()?"yes":"no");
+            vStream.writeTextElement("maxRows",      QString("%1").arg(qse->getMaxRows()));
+            vStream.writeTextElement("maxQueries",   QString("%1").arg(qse->getMaxQueries()));
+            vStream.writeTextElement("maxOutputBytes", QString("%1").arg(qse->getMaxOutputBytes()));
+            vStream.writeTextElement("maxSeconds",   QString("%1").arg(qse->getMaxSeconds()));
+            vStream.writeTextElement("maxDepth",     QString("%1").arg(qse->getMaxDepth()));
 			vStream.writeTextElement("useTimestamp", qse->getWithTimestamp()?"yes":"no");
 			vStream.writeTextElement("appendOutput", qse->getAppendOutput()?"yes":"no");
 			vStream.writeTextElement("utf8",         qse->getOutputUtf8()?"yes":"no");
 			vStream.writeTextElement("asXml",        qse->getOutputXml()?"yes":"no");
             vStream.writeTextElement("showFirst",    qse->getShowFirst()?"yes":"no");
+            vStream.writeTextElement("executeOutput", qse->getExecuteOutput()?"yes":"no");
+            vStream.writeTextElement("transactionSize", QString("%1").arg(qse->getTransactionSize()));
+            vStream.writeTextElement("snapshot",     qse->getSnapshot()?"yes":"no");
+            vStream.writeTextElement("isolationLevel", qse->getIsolationLevel());
+            vStream.writeTextElement("cursorBudget", QString("%1").arg(qse->getCursorBudget()));
+            vStream.writeTextElement("recordMode",   qse->getRecordMode());
+            vStream.writeTextElement("recordFile",   qse->getRecordFile());
+            vStream.writeTextElement("watermarkColumn", qse->getWatermarkColumn());
+            vStream.writeTextElement("watermark",    qse->getWatermark());
+            vStream.writeTextElement("pushdownRender", qse->getPushdownRender()?"yes":"no");
+            QMap<QString, BlockStatistic> stats = qse->getBlockStatistics();
+            if (!stats.isEmpty())
+            {
+                vStream.writeStartElement("blockStatistics");
+                QMapIterator<QString, BlockStatistic> bit(stats);
+                while (bit.hasNext())
+                {
+                    bit.next();
+                    vStream.writeEmptyElement("block");
+                    vStream.writeAttribute("name",      bit.key());
+                    vStream.writeAttribute("calls",     QString::number(bit.value().calls));
+                    vStream.writeAttribute("rows",      QString::number(bit.value().rows));
+                    vStream.writeAttribute("distinct",  QString::number(bit.value().distinct));
+                    vStream.writeAttribute("nanos",     QString::number(bit.value().nanos));
+                    vStream.writeAttribute("tableRows", QString::number(bit.value().tableRows));
+                }
+                vStream.writeEndElement();
+            }
 			vStream.writeEndElement();
 		}
 		vStream.writeEndDocument();
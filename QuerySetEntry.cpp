@@ -15,7 +15,23 @@ QuerySetEntry::QuerySetEntry() :
 	appendOutput(false),
 	outputUtf8(false),
 	outputXml(false),
-    showFirst(false)
+    showFirst(false),
+    executeOutput(false),
+    transactionSize(1000),
+    snapshot(false),
+    isolationLevel(""),
+    maxDepth(1000),
+    cursorBudget(32),
+    maxRows(0),
+    maxQueries(0),
+    maxOutputBytes(0),
+    maxSeconds(0),
+    recordMode(""),
+    recordFile(""),
+    watermarkColumn(""),
+    watermark(""),
+    pushdownRender(false),
+    blockStatistics()
 {
 }
 
@@ -42,6 +58,22 @@ QuerySetEntry &QuerySetEntry::operator=(const QuerySetEntry &rhs)
 		outputXml     = rhs.outputXml;
 		appendOutput  = rhs.appendOutput;
         showFirst     = false;
+        executeOutput = rhs.executeOutput;
+        transactionSize = rhs.transactionSize;
+        snapshot      = rhs.snapshot;
+        isolationLevel = rhs.isolationLevel;
+        maxDepth      = rhs.maxDepth;
+        cursorBudget  = rhs.cursorBudget;
+        maxRows       = rhs.maxRows;
+        maxQueries    = rhs.maxQueries;
+        maxOutputBytes = rhs.maxOutputBytes;
+        maxSeconds    = rhs.maxSeconds;
+        recordMode    = rhs.recordMode;
+        recordFile    = rhs.recordFile;
+        watermarkColumn = rhs.watermarkColumn;
+        watermark     = "";
+        pushdownRender = rhs.pushdownRender;
+        blockStatistics.clear();
 	}
 	return *this;
 }
@@ -182,3 +214,163 @@ void QuerySetEntry::setShowFirst(bool value)
 {
     showFirst = value;
 }
+
+bool QuerySetEntry::getExecuteOutput() const
+{
+    return executeOutput;
+}
+
+void QuerySetEntry::setExecuteOutput(bool value)
+{
+    executeOutput = value;
+}
+
+qint32 QuerySetEntry::getTransactionSize() const
+{
+    return transactionSize;
+}
+
+void QuerySetEntry::setTransactionSize(qint32 value)
+{
+    transactionSize = value;
+}
+
+bool QuerySetEntry::getSnapshot() const
+{
+    return snapshot;
+}
+
+void QuerySetEntry::setSnapshot(bool value)
+{
+    snapshot = value;
+}
+
+QString QuerySetEntry::getIsolationLevel() const
+{
+    return isolationLevel;
+}
+
+void QuerySetEntry::setIsolationLevel(const QString &value)
+{
+    isolationLevel = value;
+}
+
+qint32 QuerySetEntry::getMaxDepth() const
+{
+    return maxDepth;
+}
+
+void QuerySetEntry::setMaxDepth(qint32 value)
+{
+    maxDepth = value;
+}
+
+qint32 QuerySetEntry::getCursorBudget() const
+{
+    return cursorBudget;
+}
+
+void QuerySetEntry::setCursorBudget(qint32 value)
+{
+    cursorBudget = value;
+}
+
+qint64 QuerySetEntry::getMaxRows() const
+{
+    return maxRows;
+}
+
+void QuerySetEntry::setMaxRows(qint64 value)
+{
+    maxRows = value;
+}
+
+qint64 QuerySetEntry::getMaxQueries() const
+{
+    return maxQueries;
+}
+
+void QuerySetEntry::setMaxQueries(qint64 value)
+{
+    maxQueries = value;
+}
+
+qint64 QuerySetEntry::getMaxOutputBytes() const
+{
+    return maxOutputBytes;
+}
+
+void QuerySetEntry::setMaxOutputBytes(qint64 value)
+{
+    maxOutputBytes = value;
+}
+
+qint32 QuerySetEntry::getMaxSeconds() const
+{
+    return maxSeconds;
+}
+
+void QuerySetEntry::setMaxSeconds(qint32 value)
+{
+    maxSeconds = value;
+}
+
+QString QuerySetEntry::getRecordMode() const
+{
+    return recordMode;
+}
+
+void QuerySetEntry::setRecordMode(const QString &value)
+{
+    recordMode = value;
+}
+
+QString QuerySetEntry::getRecordFile() const
+{
+    return recordFile;
+}
+
+void QuerySetEntry::setRecordFile(const QString &value)
+{
+    recordFile = value;
+}
+
+QString QuerySetEntry::getWatermarkColumn() const
+{
+    return watermarkColumn;
+}
+
+void QuerySetEntry::setWatermarkColumn(const QString &value)
+{
+    watermarkColumn = value;
+}
+
+QString QuerySetEntry::getWatermark() const
+{
+    return watermark;
+}
+
+void QuerySetEntry::setWatermark(const QString &value)
+{
+    watermark = value;
+}
+
+bool QuerySetEntry::getPushdownRender() const
+{
+    return pushdownRender;
+}
+
+void QuerySetEntry::setPushdownRender(bool value)
+{
+    pushdownRender = value;
+}
+
+QMap<QString, BlockStatistic> QuerySetEntry::getBlockStatistics() const
+{
+    return blockStatistics;
+}
+
+void QuerySetEntry::setBlockStatistics(const QMap<QString, BlockStatistic> &value)
+{
+    blockStatistics = value;
+}
@@ -4,6 +4,20 @@
 #include "DbConnection.h"
 
 #include <QDomNode>
+#include <QMap>
+
+//! The observed values of a nested block during the last run, they
+//! are used to choose the execution strategy of the block.
+struct BlockStatistic
+{
+    BlockStatistic() : calls(0), rows(0), distinct(0), nanos(0), tableRows(0) {}
+
+    quint64 calls;      // number of block calls, one per parent row
+    quint64 rows;       // number of child rows of all calls
+    quint64 distinct;   // number of calls with different SQL
+    quint64 nanos;      // time to execute the calls
+    quint64 tableRows;  // rows of the whole table, if it was preloaded
+};
 
 class QuerySetEntry
 {
@@ -60,6 +74,54 @@ public:
     QString getDateFormat() const;
     void setDateFormat(const QString &value);
 
+    bool getExecuteOutput() const;
+    void setExecuteOutput(bool value);
+
+    qint32 getTransactionSize() const;
+    void setTransactionSize(qint32 value);
+
+    bool getSnapshot() const;
+    void setSnapshot(bool value);
+
+    QString getIsolationLevel() const;
+    void setIsolationLevel(const QString &value);
+
+    qint32 getMaxDepth() const;
+    void setMaxDepth(qint32 value);
+
+    qint32 getCursorBudget() const;
+    void setCursorBudget(qint32 value);
+
+    qint64 getMaxRows() const;
+    void setMaxRows(qint64 value);
+
+    qint64 getMaxQueries() const;
+    void setMaxQueries(qint64 value);
+
+    qint64 getMaxOutputBytes() const;
+    void setMaxOutputBytes(qint64 value);
+
+    qint32 getMaxSeconds() const;
+    void setMaxSeconds(qint32 value);
+
+    QString getRecordMode() const;
+    void setRecordMode(const QString &value);
+
+    QString getRecordFile() const;
+    void setRecordFile(const QString &value);
+
+    QString getWatermarkColumn() const;
+    void setWatermarkColumn(const QString &value);
+
+    QString getWatermark() const;
+    void setWatermark(const QString &value);
+
+    bool getPushdownRender() const;
+    void setPushdownRender(bool value);
+
+    QMap<QString, BlockStatistic> getBlockStatistics() const;
+    void setBlockStatistics(const QMap<QString, BlockStatistic> &value);
+
 private:
 	QString name;
 	QString dbname;
@@ -75,6 +137,22 @@ private:
 	bool outputUtf8;
 	bool outputXml;
     bool showFirst;
+    bool executeOutput;
+    qint32 transactionSize;
+    bool snapshot;
+    QString isolationLevel;
+    qint32 maxDepth;
+    qint32 cursorBudget;
+    qint64 maxRows;
+    qint64 maxQueries;
+    qint64 maxOutputBytes;
+    qint32 maxSeconds;
+    QString recordMode;
+    QString recordFile;
+    QString watermarkColumn;
+    QString watermark;
+    bool pushdownRender;
+    QMap<QString, BlockStatistic> blockStatistics;
 };
 
 #endif // QUERYSETENTRY_H
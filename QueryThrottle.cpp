@@ -0,0 +1,178 @@
+#include "QueryThrottle.h"
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QtMath>
+
+//! the longest wait without processing the events of the application
+static const unsigned long waitSliceMs = 20;
+
+//! the registered throttles for the Qt connection names
+static QHash<QString, QueryThrottle*> throttles;
+static QMutex throttlesMutex;
+
+QueryThrottle::QueryThrottle()
+    : mutex(),
+      slotFree(),
+      rate(0.0),
+      tokens(0.0),
+      maxConcurrent(0),
+      running(0),
+      cursors(0),
+      refillTimer(),
+      throttledNanos(0),
+      throttledQueries(0)
+{
+}
+
+//! \param aQueriesPerSecond the rate of the token bucket, 0 is unlimited
+//! \param aMaxConcurrent the number of statements at the same time, 0 is unlimited
+void QueryThrottle::configure(double aQueriesPerSecond, qint32 aMaxConcurrent)
+{
+    QMutexLocker l(&mutex);
+
+    rate = qMax(0.0, aQueriesPerSecond);
+    maxConcurrent = qMax(0, aMaxConcurrent);
+    // the bucket holds the queries of one second as burst
+    tokens = qMax(1.0, rate);
+    refillTimer.start();
+}
+
+void QueryThrottle::refill()
+{
+    double burst = qMax(1.0, rate);
+    tokens = qMin(burst, tokens + rate * refillTimer.nsecsElapsed() / 1e9);
+    refillTimer.start();
+}
+
+//! Wait for a free slot and a token. The open cursors aren't waited for,
+//! they belong to the calling thread and are closed by the executor before
+//! a new block query (see hasFreeSlot). The events are processed while
+//! waiting, so the user interface doesn't freeze.
+//! \return the waiting time in nanoseconds
+qint64 QueryThrottle::acquire()
+{
+    QElapsedTimer t;
+    t.start();
+    QMutexLocker l(&mutex);
+
+    while (maxConcurrent > 0 && running >= maxConcurrent)
+    {
+        l.unlock();
+        QCoreApplication::processEvents();
+        l.relock();
+        slotFree.wait(&mutex, waitSliceMs);
+    }
+
+    while (rate > 0.0)
+    {
+        refill();
+        if (tokens >= 1.0)
+        {
+            tokens -= 1.0;
+            break;
+        }
+
+        // sleep until the next token is available
+        unsigned long waitMs = static_cast<unsigned long>(qCeil((1.0 - tokens) * 1000.0 / rate));
+        l.unlock();
+        QCoreApplication::processEvents();
+        QThread::msleep(qBound(1UL, waitMs, waitSliceMs));
+        l.relock();
+    }
+    running++;
+
+    qint64 waited = t.nsecsElapsed();
+    if (waited > 1000000)
+    {
+        // waiting less than a millisecond is the cost of the lock
+        throttledNanos += waited;
+        throttledQueries++;
+    }
+
+    return waited;
+}
+
+void QueryThrottle::release()
+{
+    QMutexLocker l(&mutex);
+
+    if (running > 0) running--;
+    slotFree.wakeOne();
+}
+
+//! An open cursor holds a slot until it is closed.
+void QueryThrottle::openCursor()
+{
+    QMutexLocker l(&mutex);
+    cursors++;
+}
+
+void QueryThrottle::closeCursor()
+{
+    QMutexLocker l(&mutex);
+
+    if (cursors > 0) cursors--;
+    slotFree.wakeOne();
+}
+
+//! \return true if a new statement doesn't exceed the concurrency limit
+bool QueryThrottle::hasFreeSlot() const
+{
+    QMutexLocker l(&mutex);
+    return 0 == maxConcurrent || running + cursors < maxConcurrent;
+}
+
+quint64 QueryThrottle::getThrottledNanos() const
+{
+    QMutexLocker l(&mutex);
+    return throttledNanos;
+}
+
+quint64 QueryThrottle::getThrottledQueries() const
+{
+    QMutexLocker l(&mutex);
+    return throttledQueries;
+}
+
+void QueryThrottle::attach(const QString &aConnectionName, QueryThrottle *aThrottle)
+{
+    QMutexLocker l(&throttlesMutex);
+    throttles.insert(aConnectionName, aThrottle);
+}
+
+//! Remove the throttle, only if it is still registered for the connection.
+void QueryThrottle::detach(const QString &aConnectionName, QueryThrottle *aThrottle)
+{
+    QMutexLocker l(&throttlesMutex);
+    if (throttles.value(aConnectionName, nullptr) == aThrottle)
+    {
+        throttles.remove(aConnectionName);
+    }
+}
+
+//! \return the active throttle of the connection or nullptr
+QueryThrottle *QueryThrottle::forConnection(const QString &aConnectionName)
+{
+    QMutexLocker l(&throttlesMutex);
+    QueryThrottle *t = throttles.value(aConnectionName, nullptr);
+
+    return (nullptr != t && t->isActive()) ? t : nullptr;
+}
+
+ThrottleGuard::ThrottleGuard(const QSqlDatabase &aDb)
+    : throttle(QueryThrottle::forConnection(aDb.connectionName()))
+{
+    if (nullptr != throttle) throttle->acquire();
+}
+
+ThrottleGuard::ThrottleGuard(const QString &aConnectionName)
+    : throttle(QueryThrottle::forConnection(aConnectionName))
+{
+    if (nullptr != throttle) throttle->acquire();
+}
+
+ThrottleGuard::~ThrottleGuard()
+{
+    if (nullptr != throttle) throttle->release();
+}
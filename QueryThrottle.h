@@ -0,0 +1,69 @@
+#ifndef QUERYTHROTTLE_H
+#define QUERYTHROTTLE_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <QtSql/QSqlDatabase>
+
+//! Limits the queries sent to one database connection. A token bucket
+//! restricts the queries per second and a counting semaphore the number
+//! of statements executed at the same time. An open cursor of a row
+//! source holds a slot until it is closed. The throttle is registered
+//! for the Qt connection name, so every query at this connection can
+//! find it. The time waiting for a token or a free slot is summed up.
+class QueryThrottle
+{
+public:
+    QueryThrottle();
+
+    void configure(double aQueriesPerSecond, qint32 aMaxConcurrent);
+    bool isActive() const { return rate > 0.0 || maxConcurrent > 0; }
+
+    qint64 acquire();
+    void release();
+
+    void openCursor();
+    void closeCursor();
+    bool hasFreeSlot() const;
+
+    quint64 getThrottledNanos() const;
+    quint64 getThrottledQueries() const;
+
+    static void attach(const QString &aConnectionName, QueryThrottle *aThrottle);
+    static void detach(const QString &aConnectionName, QueryThrottle *aThrottle);
+    static QueryThrottle *forConnection(const QString &aConnectionName);
+
+private:
+    void refill();
+
+    mutable QMutex mutex;
+    QWaitCondition slotFree;
+    double rate;
+    double tokens;
+    qint32 maxConcurrent;
+    qint32 running;
+    qint32 cursors;
+    QElapsedTimer refillTimer;
+    quint64 throttledNanos;
+    quint64 throttledQueries;
+};
+
+//! Acquire the throttle of the connection for the lifetime of the
+//! guard, usually around the exec() call of a query.
+class ThrottleGuard
+{
+public:
+    explicit ThrottleGuard(const QSqlDatabase &aDb);
+    explicit ThrottleGuard(const QString &aConnectionName = QString(QSqlDatabase::defaultConnection));
+    ~ThrottleGuard();
+
+private:
+    Q_DISABLE_COPY(ThrottleGuard)
+
+    QueryThrottle *throttle;
+};
+
+#endif // QUERYTHROTTLE_H
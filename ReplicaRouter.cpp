@@ -0,0 +1,127 @@
+#include "ReplicaRouter.h"
+
+#include <QStringList>
+
+//! the first back off time after a failure and the upper limit
+static const qint64 minBackoffMs = 5000;
+static const qint64 maxBackoffMs = 300000;
+
+ReplicaRouter::ReplicaRouter()
+    : mutex(),
+      endpoints(),
+      connections()
+{
+}
+
+//! \param aList the endpoints separated by semicolon, e.g. host1:5432;host2:5432
+void ReplicaRouter::setEndpoints(const QString &aList)
+{
+    QMutexLocker l(&mutex);
+
+    endpoints.clear();
+    connections.clear();
+    foreach (const QString &e, aList.split(';', Qt::SkipEmptyParts))
+    {
+        if (!e.trimmed().isEmpty())
+        {
+            Endpoint ep;
+            ep.address = e.trimmed();
+            endpoints.append(ep);
+        }
+    }
+}
+
+//! Choose the endpoint for the connection, ejected endpoints are only used
+//! after their back off time. If all endpoints are ejected, the endpoint
+//! with the earliest retry time is used.
+//! \return the index of the endpoint
+qint32 ReplicaRouter::acquire(const QString &aConnectionName)
+{
+    QMutexLocker l(&mutex);
+
+    if (endpoints.isEmpty())
+    {
+        return -1;
+    }
+
+    QDateTime now = QDateTime::currentDateTimeUtc();
+    qint32 best = -1;
+    qint32 earliest = 0;
+    for (qint32 i = 0; i < endpoints.size(); ++i)
+    {
+        const Endpoint &ep = endpoints.at(i);
+        if (ep.retryAt.isValid() && ep.retryAt < endpoints.at(earliest).retryAt)
+        {
+            earliest = i;
+        }
+        if (ep.retryAt.isValid() && ep.retryAt > now)
+        {
+            continue;
+        }
+        if (best < 0 || ep.outstanding < endpoints.at(best).outstanding
+                || (ep.outstanding == endpoints.at(best).outstanding && ep.uses < endpoints.at(best).uses))
+        {
+            best = i;
+        }
+    }
+    if (best < 0)
+    {
+        best = earliest;
+    }
+
+    endpoints[best].outstanding++;
+    endpoints[best].uses++;
+    connections.insert(aConnectionName, best);
+
+    return best;
+}
+
+//! Release the endpoint of the connection, a failed endpoint is ejected.
+void ReplicaRouter::release(const QString &aConnectionName, bool aFailed)
+{
+    QMutexLocker l(&mutex);
+
+    qint32 idx = connections.value(aConnectionName, -1);
+    if (idx < 0)
+    {
+        return;
+    }
+    connections.remove(aConnectionName);
+
+    Endpoint &ep = endpoints[idx];
+    ep.outstanding = qMax(0, ep.outstanding - 1);
+    if (aFailed)
+    {
+        qint64 backoff = qMin(maxBackoffMs, minBackoffMs << qMin(ep.failures, 10));
+        ep.failures++;
+        ep.retryAt = QDateTime::currentDateTimeUtc().addMSecs(backoff);
+    }
+}
+
+//! The connection was opened, an ejected endpoint is healthy again.
+void ReplicaRouter::markHealthy(const QString &aConnectionName)
+{
+    QMutexLocker l(&mutex);
+
+    qint32 idx = connections.value(aConnectionName, -1);
+    if (idx >= 0)
+    {
+        endpoints[idx].failures = 0;
+        endpoints[idx].retryAt = QDateTime();
+    }
+}
+
+QString ReplicaRouter::statistics() const
+{
+    QMutexLocker l(&mutex);
+
+    QStringList sl;
+    QDateTime now = QDateTime::currentDateTimeUtc();
+    foreach (const Endpoint &ep, endpoints)
+    {
+        sl << QString("%1 %2 uses%3").arg(ep.address).arg(ep.uses)
+              .arg(ep.retryAt.isValid() && ep.retryAt > now ? QString(" (ejected)") : QString(""));
+    }
+
+    return sl.join(", ");
+}
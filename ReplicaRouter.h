@@ -0,0 +1,49 @@
+#ifndef REPLICAROUTER_H
+#define REPLICAROUTER_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+//! Spreads the read only connections of a database over a list of replica
+//! endpoints. Every connect uses the healthy endpoint with the fewest
+//! outstanding connections. An endpoint which can't be opened is ejected
+//! and probed again by the next connect after a back off time, which is
+//! doubled for every failure up to five minutes. There is no probe timer
+//! and the load are the open connections, not the running queries.
+class ReplicaRouter
+{
+public:
+    ReplicaRouter();
+
+    void setEndpoints(const QString &aList);
+    bool isActive() const { return !endpoints.isEmpty(); }
+    qint32 size() const { return static_cast<qint32>(endpoints.size()); }
+
+    qint32 acquire(const QString &aConnectionName);
+    void release(const QString &aConnectionName, bool aFailed);
+    void markHealthy(const QString &aConnectionName);
+
+    QString endpoint(qint32 aIndex) const { return endpoints.at(aIndex).address; }
+    QString statistics() const;
+
+private:
+    struct Endpoint
+    {
+        Endpoint() : address(""), outstanding(0), uses(0), failures(0), retryAt() {}
+
+        QString address;
+        qint32 outstanding;             // connections using this endpoint
+        quint64 uses;
+        qint32 failures;                // failures since the last success
+        QDateTime retryAt;              // ejected until this time
+    };
+
+    mutable QMutex mutex;
+    QList<Endpoint> endpoints;
+    QHash<QString, qint32> connections;
+};
+
+#endif // REPLICAROUTER_H
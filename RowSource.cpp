@@ -0,0 +1,881 @@
+#include "RowSource.h"
+#include "QueryThrottle.h"
+#include "SqlDialect.h"
+#include "Utility.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QElapsedTimer>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlRecord>
+
+//! Convert a JSON value into a variant, nested structures are
+//! returned as compact JSON text.
+static QVariant jsonToVariant(const QJsonValue &v)
+{
+    if (v.isArray())
+    {
+        return QJsonDocument(v.toArray()).toJson(QJsonDocument::Compact);
+    }
+    if (v.isObject())
+    {
+        return QJsonDocument(v.toObject()).toJson(QJsonDocument::Compact);
+    }
+    if (v.isNull() || v.isUndefined())
+    {
+        return QVariant();
+    }
+
+    return v.toVariant();
+}
+
+static bool isJsonSpace(char c)
+{
+    return ' ' == c || '\t' == c || '\n' == c || '\r' == c;
+}
+
+RowSource::RowSource()
+    : lastError(""),
+      current(),
+      buffered(),
+      slot(nullptr)
+{
+}
+
+RowSource::~RowSource()
+{
+    releaseSlot();
+}
+
+//! The buffered rows are returned first, they are read before the cursor is closed.
+bool RowSource::next()
+{
+    if (!buffered.isEmpty())
+    {
+        current = buffered.takeFirst();
+        return true;
+    }
+
+    if (!fetch(current))
+    {
+        releaseSlot();
+        return false;
+    }
+
+    return true;
+}
+
+//! Read the rows of an open cursor into memory and close it.
+void RowSource::releaseCursor()
+{
+    closeCursor(buffered);
+    releaseSlot();
+}
+
+//! The open cursor holds a slot of the connection throttle until the cursor
+//! is closed, all rows are read or the source is deleted.
+void RowSource::holdSlot(QueryThrottle *aThrottle)
+{
+    if (nullptr == slot && nullptr != aThrottle && holdsCursor())
+    {
+        slot = aThrottle;
+        slot->openCursor();
+    }
+}
+
+void RowSource::releaseSlot()
+{
+    if (nullptr != slot)
+    {
+        slot->closeCursor();
+        slot = nullptr;
+    }
+}
+
+//! Read up to n following rows without moving the current row.
+//! \return the next rows, the list is shorter at the end of the source
+const QList<RowSource::Row> &RowSource::lookahead(qint32 n)
+{
+    Row r;
+    while (buffered.size() < n && fetch(r))
+    {
+        buffered.append(r);
+    }
+
+    return buffered;
+}
+
+QueryRowSource::QueryRowSource(const QSqlQuery &aQuery)
+    : RowSource(),
+      query(aQuery),
+      fieldNames()
+{
+    QSqlRecord rec = query.record();
+    for (int i = 0; i < rec.count(); ++i)
+    {
+        fieldNames << rec.fieldName(i);
+    }
+}
+
+bool QueryRowSource::fetch(Row &row)
+{
+    if (!query.next())
+    {
+        return false;
+    }
+
+    qint32 numCols = static_cast<qint32>(fieldNames.size());
+    row.fields = fieldNames;
+    row.values.resize(numCols);
+    for (qint32 i = 0; i < numCols; ++i)
+    {
+        row.values[i] = query.value(i);
+    }
+
+    return true;
+}
+
+void QueryRowSource::closeCursor(QList<Row> &rows)
+{
+    Row r;
+    while (fetch(r))
+    {
+        rows.append(r);
+    }
+    query.finish();
+}
+
+MemoryRowSource::MemoryRowSource(const QList<Row> &aRows)
+    : RowSource(),
+      rows(aRows),
+      pos(0)
+{
+}
+
+bool MemoryRowSource::fetch(Row &row)
+{
+    if (pos >= rows.size())
+    {
+        return false;
+    }
+
+    row = rows.at(pos++);
+    return true;
+}
+
+//! \param aFormat is json, comma, tab, lf or the delimiter itself. Without a
+//! format a value starting with [ or { is read as JSON otherwise a semicolon
+//! separated list is expected.
+ListRowSource::ListRowSource(const QByteArray &aData, const QString &aFormat)
+    : RowSource(),
+      data(aData.trimmed()),
+      delimiter(";"),
+      json(false),
+      pos(0),
+      index(0)
+{
+    QString fmt = aFormat.trimmed().toLower();
+
+    if (fmt.isEmpty())
+    {
+        json = data.startsWith('[') || data.startsWith('{');
+    }
+    else if ("json" == fmt)         { json = true; }
+    else if ("comma" == fmt)        { delimiter = ","; }
+    else if ("tab" == fmt)          { delimiter = "\t"; }
+    else if ("lf" == fmt)           { delimiter = "\n"; }
+    else                            { delimiter = aFormat.trimmed().toUtf8(); }
+
+    if (json)
+    {
+        // a single value is handled like an array with one element
+        if (data.startsWith('['))
+        {
+            pos = 1;
+        }
+        else
+        {
+            data = "[" + data + "]";
+            pos = 1;
+        }
+    }
+}
+
+bool ListRowSource::fetch(Row &row)
+{
+    QByteArray element;
+
+    row.fields.clear();
+    row.values.clear();
+
+    if (json)
+    {
+        if (!nextJsonElement(element))
+        {
+            return false;
+        }
+
+        row.fields << "__INDEX" << "__VALUE";
+        row.values << index++;
+
+        QJsonParseError err;
+        QJsonDocument doc = QJsonDocument::fromJson("[" + element + "]", &err);
+        if (QJsonParseError::NoError != err.error)
+        {
+            row.values << element;
+            return true;
+        }
+
+        QJsonValue v = doc.array().at(0);
+        row.values << (v.isString() || v.isNull() ? jsonToVariant(v) : QVariant(element));
+        if (v.isObject())
+        {
+            QJsonObject obj = v.toObject();
+            for (auto it = obj.constBegin(); it != obj.constEnd(); ++it)
+            {
+                row.fields << it.key();
+                row.values << jsonToVariant(it.value());
+            }
+        }
+    }
+    else
+    {
+        if (!nextDelimitedElement(element))
+        {
+            return false;
+        }
+
+        row.fields << "__INDEX" << "__VALUE";
+        row.values << index++ << QString::fromUtf8(element);
+    }
+
+    return true;
+}
+
+//! Find the next top level element of the array without parsing it,
+//! only strings and the nesting depth are tracked.
+bool ListRowSource::nextJsonElement(QByteArray &element)
+{
+    qsizetype len = data.size();
+
+    while (pos < len && (',' == data.at(pos) || isJsonSpace(data.at(pos))))
+    {
+        pos++;
+    }
+
+    if (pos >= len || ']' == data.at(pos))
+    {
+        return false;
+    }
+
+    qsizetype start = pos;
+    qint32 depth = 0;
+    bool inString = false;
+    for (; pos < len; ++pos)
+    {
+        char c = data.at(pos);
+        if (inString)
+        {
+            if ('\\' == c)      pos++;
+            else if ('"' == c)  inString = false;
+        }
+        else if ('"' == c)
+        {
+            inString = true;
+        }
+        else if ('[' == c || '{' == c)
+        {
+            depth++;
+        }
+        else if (']' == c || '}' == c)
+        {
+            if (0 == depth) break;
+            depth--;
+        }
+        else if (',' == c && 0 == depth)
+        {
+            break;
+        }
+    }
+
+    element = data.mid(start, pos - start).trimmed();
+    return !element.isEmpty();
+}
+
+//! Return the next non empty element of the delimited list.
+bool ListRowSource::nextDelimitedElement(QByteArray &element)
+{
+    qsizetype len = data.size();
+
+    while (pos < len)
+    {
+        qsizetype end = data.indexOf(delimiter, pos);
+        if (end < 0) end = len;
+
+        element = data.mid(pos, end - pos).trimmed();
+        pos = end + delimiter.size();
+
+        if (!element.isEmpty())
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//! \param aSql is the query without ORDER BY, the key column must be part of the result
+//! \param aPageSize the number of rows for the first page
+//! \param aTargetMs the wanted time in milliseconds to read one page
+KeysetRowSource::KeysetRowSource(QSqlDatabase aDb, const QString &aDbType, const QString &aSql,
+                                 const QString &aKey, qint32 aPageSize, qint32 aTargetMs)
+    : RowSource(),
+      db(aDb),
+      dbType(aDbType),
+      sql(aSql),
+      key(aKey),
+      query(),
+      fieldNames(),
+      keyIndex(-1),
+      lastKey(),
+      pageSize(aPageSize > 0 ? aPageSize : 1000),
+      targetMs(aTargetMs > 0 ? aTargetMs : 500),
+      pageRows(0),
+      requestedRows(0),
+      pageCount(0),
+      morePages(true),
+      pageNanos(0),
+      rowCount(0)
+{
+}
+
+QString KeysetRowSource::statistics() const
+{
+    return QString("keyset on %1 read %2 rows in %3 pages, last page size %4")
+            .arg(key).arg(rowCount).arg(pageCount).arg(pageSize);
+}
+
+bool KeysetRowSource::fetch(Row &row)
+{
+    while (lastError.isEmpty())
+    {
+        if (query.isActive())
+        {
+            if (readPageRow(row))
+            {
+                return true;
+            }
+            endPage();
+        }
+
+        if (!morePages || !nextPage())
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+//! Only the rest of the current page is buffered, the next page
+//! is read as usual.
+void KeysetRowSource::closeCursor(QList<Row> &rows)
+{
+    if (query.isActive())
+    {
+        Row r;
+        while (readPageRow(r))
+        {
+            rows.append(r);
+        }
+        endPage();
+    }
+}
+
+bool KeysetRowSource::readPageRow(Row &row)
+{
+    QElapsedTimer t;
+    t.start();
+    bool ok = query.next();
+    pageNanos += t.nsecsElapsed();
+
+    if (ok)
+    {
+        qint32 numCols = static_cast<qint32>(fieldNames.size());
+        row.fields = fieldNames;
+        row.values.resize(numCols);
+        for (qint32 i = 0; i < numCols; ++i)
+        {
+            row.values[i] = query.value(i);
+        }
+        lastKey = row.values.at(keyIndex);
+        pageRows++;
+        rowCount++;
+    }
+
+    return ok;
+}
+
+//! Release the cursor of the page, a page with less rows than
+//! requested is the last one.
+void KeysetRowSource::endPage()
+{
+    query.finish();
+    adaptPageSize();
+    morePages = pageRows >= requestedRows;
+}
+
+bool KeysetRowSource::nextPage()
+{
+    QString pageSql = "SELECT * FROM (" + sql + ") sr_page";
+    if (pageCount > 0)
+    {
+        pageSql += " WHERE " + key + " > :last";
+    }
+    pageSql += " ORDER BY " + key;
+    pageSql = SqlDialect::limitQuery(dbType, pageSql, pageSize);
+
+    query = QSqlQuery(db);
+    query.setForwardOnly(true);
+
+    QElapsedTimer t;
+    t.start();
+    bool ok = query.prepare(pageSql);
+    if (ok)
+    {
+        if (pageCount > 0)
+        {
+            query.bindValue(":last", lastKey);
+        }
+        ThrottleGuard guard(db);
+        ok = query.exec();
+    }
+    pageNanos = t.nsecsElapsed();
+
+    if (!ok)
+    {
+        lastError = QString("%1 (%2)").arg(pageSql, query.lastError().text());
+        return false;
+    }
+
+    if (0 == pageCount)
+    {
+        QSqlRecord rec = query.record();
+        for (int i = 0; i < rec.count(); ++i)
+        {
+            fieldNames << rec.fieldName(i);
+        }
+        keyIndex = rec.indexOf(key);
+        if (keyIndex < 0)
+        {
+            lastError = QString("key column '%1' isn't part of the result").arg(key);
+            query.finish();
+            return false;
+        }
+    }
+
+    pageCount++;
+    pageRows = 0;
+    requestedRows = pageSize;
+
+    return true;
+}
+
+void KeysetRowSource::adaptPageSize()
+{
+    const qint32 minPageSize = 100;
+    const qint32 maxPageSize = 100000;
+    qint64 ms = pageNanos / 1000000;
+
+    if (ms < targetMs / 2 && pageSize < maxPageSize)
+    {
+        pageSize = qMin(pageSize * 2, maxPageSize);
+    }
+    else if (ms > targetMs && pageSize > minPageSize)
+    {
+        pageSize = qMax(pageSize / 2, minPageSize);
+    }
+}
+
+//! \param aQuery is the executed query, all rows are read
+//! \param aColumns the declared column order, other columns are appended in the
+//! order of their first occurrence
+PivotRowSource::PivotRowSource(QSqlQuery &aQuery, const QString &aRowKey, const QString &aColumnKey,
+                               const QString &aValue, const QVariant &aDefault, const QStringList &aColumns)
+    : RowSource(),
+      rowKey(aRowKey),
+      defaultValue(aDefault),
+      columns(aColumns),
+      rowKeys(),
+      cells(),
+      columnsJson(),
+      pos(0),
+      readRows(0)
+{
+    QSqlRecord rec = aQuery.record();
+    qint32 rowIdx = rec.indexOf(aRowKey);
+    qint32 colIdx = rec.indexOf(aColumnKey);
+    qint32 valIdx = rec.indexOf(aValue);
+    if (rowIdx < 0 || colIdx < 0 || valIdx < 0)
+    {
+        lastError = QString("columns '%1', '%2' and '%3' must be part of the result")
+                .arg(aRowKey, aColumnKey, aValue);
+        return;
+    }
+
+    QHash<QString, qint32> rowIndex;
+    QHash<QString, qint32> colIndex;
+    for (qint32 c = 0; c < columns.size(); ++c)
+    {
+        colIndex.insert(columns.at(c), c);
+    }
+
+    while (aQuery.next())
+    {
+        readRows++;
+        QString r = aQuery.value(rowIdx).toString();
+        QString c = aQuery.value(colIdx).toString();
+        QVariant v = aQuery.value(valIdx);
+
+        qint32 ci = colIndex.value(c, -1);
+        if (ci < 0)
+        {
+            ci = static_cast<qint32>(columns.size());
+            colIndex.insert(c, ci);
+            columns << c;
+        }
+        qint32 ri = rowIndex.value(r, -1);
+        if (ri < 0)
+        {
+            ri = static_cast<qint32>(rowKeys.size());
+            rowIndex.insert(r, ri);
+            rowKeys << r;
+            cells << QVariantList();
+        }
+
+        QVariantList &cellRow = cells[ri];
+        if (cellRow.size() <= ci)
+        {
+            cellRow.resize(ci + 1);
+        }
+
+        // a second value for the same cell is added
+        bool okOld = false, okNew = false;
+        double d = cellRow.at(ci).toDouble(&okOld) + v.toDouble(&okNew);
+        cellRow[ci] = (okOld && okNew) ? QVariant(d) : v;
+    }
+    aQuery.finish();
+
+    columnsJson = QJsonDocument(QJsonArray::fromStringList(columns)).toJson(QJsonDocument::Compact);
+}
+
+QString PivotRowSource::statistics() const
+{
+    return QString("pivot read %1 rows into %2 rows and %3 columns")
+            .arg(readRows).arg(rowKeys.size()).arg(columns.size());
+}
+
+bool PivotRowSource::fetch(Row &row)
+{
+    if (pos >= rowKeys.size())
+    {
+        return false;
+    }
+
+    const QVariantList &cellRow = cells.at(pos);
+    QJsonArray values;
+
+    row.fields.clear();
+    row.values.clear();
+    row.fields << rowKey;
+    row.values << rowKeys.at(pos);
+    for (qsizetype c = 0; c < columns.size(); ++c)
+    {
+        QVariant v = c < cellRow.size() && !cellRow.at(c).isNull() ? cellRow.at(c) : defaultValue;
+        row.fields << columns.at(c);
+        row.values << v;
+        values.append(QJsonValue::fromVariant(v));
+    }
+    row.fields << "__COLUMNS" << "__VALUES";
+    row.values << columnsJson << QJsonDocument(values).toJson(QJsonDocument::Compact);
+    pos++;
+
+    return true;
+}
+
+//! \param aQuery is the executed query, all rows are read
+//! \param aIdColumn the unique id of a row, a duplicate id is an error
+//! \param aParentColumn the id of the parent row, rows without an existing
+//! parent are the roots of the hierarchy
+HierarchyIndex::HierarchyIndex(const QString &aName, QSqlQuery &aQuery,
+                               const QString &aIdColumn, const QString &aParentColumn)
+    : name(aName),
+      lastError(""),
+      fieldNames(),
+      rows(),
+      idIndex(-1),
+      rootNodes(),
+      childNodes(),
+      unreachable(0)
+{
+    QSqlRecord rec = aQuery.record();
+    for (int i = 0; i < rec.count(); ++i)
+    {
+        fieldNames << rec.fieldName(i);
+    }
+    idIndex = rec.indexOf(aIdColumn);
+    qint32 parentIndex = rec.indexOf(aParentColumn);
+    if (idIndex < 0 || parentIndex < 0)
+    {
+        lastError = QString("columns '%1' and '%2' must be part of the result").arg(aIdColumn, aParentColumn);
+        return;
+    }
+
+    QHash<QString, qint32> ids;
+    QStringList parents;
+    qint32 numCols = static_cast<qint32>(fieldNames.size());
+    while (aQuery.next())
+    {
+        QVariantList values;
+        values.reserve(numCols);
+        for (qint32 i = 0; i < numCols; ++i)
+        {
+            values << aQuery.value(i);
+        }
+        // a second row with the same id would be reached again below every
+        // parent of this id, the walk through the hierarchy wouldn't end
+        QString rowId = values.at(idIndex).toString();
+        if (ids.contains(rowId))
+        {
+            lastError = QString("the id '%1' of column %2 isn't unique (rows %3 and %4)")
+                    .arg(rowId, aIdColumn).arg(ids.value(rowId) + 1).arg(rows.size() + 1);
+            aQuery.finish();
+            rows.clear();
+            return;
+        }
+        ids.insert(rowId, static_cast<qint32>(rows.size()));
+        parents << (values.at(parentIndex).isNull() ? QString("") : values.at(parentIndex).toString());
+        rows << values;
+    }
+    aQuery.finish();
+
+    for (qint32 n = 0; n < rows.size(); ++n)
+    {
+        const QString &p = parents.at(n);
+        if (p.isEmpty() || !ids.contains(p) || p == id(n))
+        {
+            rootNodes << n;
+        }
+        else
+        {
+            childNodes[p] << n;
+        }
+    }
+
+    // nodes at a cycle are never reached from a root
+    qint32 reached = 0;
+    QList<qint32> pending = rootNodes;
+    while (!pending.isEmpty())
+    {
+        reached++;
+        pending << children(pending.takeLast());
+    }
+    unreachable = nodeCount() - reached;
+}
+
+HierarchyRowSource::HierarchyRowSource(QSharedPointer<HierarchyIndex> aIndex)
+    : HierarchyRowSource(aIndex, aIndex->roots(), 0, QString(""))
+{
+}
+
+HierarchyRowSource::HierarchyRowSource(QSharedPointer<HierarchyIndex> aIndex, const QList<qint32> &aNodes,
+                                       qint32 aDepth, const QString &aParentPath)
+    : RowSource(),
+      index(aIndex),
+      nodes(aNodes),
+      depth(aDepth),
+      parentPath(aParentPath),
+      pos(0),
+      currentNode(-1),
+      currentPath("")
+{
+}
+
+//! \return a new source with the children of the current node
+HierarchyRowSource *HierarchyRowSource::childSource() const
+{
+    QList<qint32> childNodes;
+    if (currentNode >= 0)
+    {
+        childNodes = index->children(currentNode);
+    }
+
+    return new HierarchyRowSource(index, childNodes, depth + 1, currentPath);
+}
+
+bool HierarchyRowSource::fetch(Row &row)
+{
+    if (pos >= nodes.size())
+    {
+        return false;
+    }
+
+    currentNode = nodes.at(pos++);
+    currentPath = parentPath.isEmpty() ? index->id(currentNode) : parentPath + "/" + index->id(currentNode);
+
+    row.fields = index->getFieldNames();
+    row.fields << "__DEPTH" << "__PATH";
+    row.values = index->values(currentNode);
+    row.values << depth << currentPath;
+
+    return true;
+}
+
+MergeCursor::MergeCursor(QSqlDatabase aDb, const QString &aSql, const QString &aKey)
+    : db(aDb),
+      sql(aSql),
+      key(aKey),
+      query(),
+      fieldNames(),
+      keyIndex(-1),
+      pending(),
+      hasPending(false),
+      exhausted(false),
+      lastParentKey(),
+      lastChildKey(),
+      unordered(false),
+      lastError(""),
+      rowCount(0),
+      skipped(0)
+{
+}
+
+//! Execute the child query ordered by the key.
+bool MergeCursor::open()
+{
+    QString mergeSql = "SELECT * FROM (" + sql + ") sr_merge ORDER BY " + key;
+
+    query = QSqlQuery(db);
+    query.setForwardOnly(true);
+    bool ok = false;
+    {
+        ThrottleGuard guard(db);
+        ok = query.exec(mergeSql);
+    }
+    if (!ok)
+    {
+        lastError = QString("%1 (%2)").arg(mergeSql, query.lastError().text());
+        exhausted = true;
+        return false;
+    }
+
+    QSqlRecord rec = query.record();
+    for (int i = 0; i < rec.count(); ++i)
+    {
+        fieldNames << rec.fieldName(i);
+    }
+    keyIndex = rec.indexOf(key);
+    if (keyIndex < 0)
+    {
+        lastError = QString("key column '%1' isn't part of the result").arg(key);
+        exhausted = true;
+        query.finish();
+        return false;
+    }
+
+    return true;
+}
+
+//! Read the next child row. The database orders the rows with its own
+//! collation, a key which is smaller than the previous one at the client
+//! comparison (e.g. a case insensitive collation or mixed numbers and
+//! text) would skip child rows silently, so the merge stops with an error.
+bool MergeCursor::readPending()
+{
+    if (exhausted || !query.next())
+    {
+        exhausted = true;
+        return false;
+    }
+
+    qint32 numCols = static_cast<qint32>(fieldNames.size());
+    pending.fields = fieldNames;
+    pending.values.resize(numCols);
+    for (qint32 i = 0; i < numCols; ++i)
+    {
+        pending.values[i] = query.value(i);
+    }
+
+    const QVariant &childKey = pending.values.at(keyIndex);
+    if (lastChildKey.isValid() && Utility::compareValues(childKey, lastChildKey) < 0)
+    {
+        lastError = QString("the child key '%1' follows '%2', the database orders %3 differently")
+                .arg(childKey.toString(), lastChildKey.toString(), key);
+        exhausted = true;
+        query.finish();
+        return false;
+    }
+    lastChildKey = childKey;
+    hasPending = true;
+
+    return true;
+}
+
+//! Return the next child row with the given key, rows with a smaller key
+//! have no parent and are skipped.
+//! \return false if there are no more rows for this key
+bool MergeCursor::next(const QVariant &aKey, RowSource::Row &row)
+{
+    if (lastParentKey.isValid() && Utility::compareValues(aKey, lastParentKey) < 0)
+    {
+        unordered = true;
+    }
+    lastParentKey = aKey;
+
+    while (hasPending || readPending())
+    {
+        int cmp = Utility::compareValues(pending.values.at(keyIndex), aKey);
+        if (cmp == 0)
+        {
+            row = pending;
+            hasPending = false;
+            rowCount++;
+            return true;
+        }
+        if (cmp > 0)
+        {
+            // the row belongs to a following parent row
+            return false;
+        }
+        hasPending = false;
+        skipped++;
+    }
+
+    return false;
+}
+
+QString MergeCursor::statistics() const
+{
+    return QString("merge on %1 read %2 rows, %3 rows without parent")
+            .arg(key).arg(rowCount).arg(skipped);
+}
+
+MergeRowSource::MergeRowSource(MergeCursor *aCursor, const QVariant &aKey)
+    : RowSource(),
+      cursor(aCursor),
+      key(aKey)
+{
+}
+
+bool MergeRowSource::fetch(Row &row)
+{
+    if (!cursor->next(key, row))
+    {
+        lastError = cursor->getLastError();
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,291 @@
+#ifndef ROWSOURCE_H
+#define ROWSOURCE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QVariantList>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+class QueryThrottle;
+
+//! A row source delivers the data rows for one template block. Every
+//! row is a list of named values, the names can change from row to row.
+class RowSource
+{
+public:
+    struct Row
+    {
+        QStringList fields;
+        QVariantList values;
+    };
+
+    RowSource();
+    virtual ~RowSource();
+
+    bool next();
+    qint32 count() const { return static_cast<qint32>(current.values.size()); }
+    QString fieldName(qint32 i) const { return current.fields.at(i); }
+    QVariant value(qint32 i) const { return current.values.at(i); }
+    bool isNull(qint32 i) const { return current.values.at(i).isNull(); }
+    const Row &row() const { return current; }
+
+    QString getLastError() const { return lastError; }
+    virtual QString statistics() const { return QString(""); }
+
+    virtual bool holdsCursor() const { return false; }
+    void releaseCursor();
+    void holdSlot(QueryThrottle *aThrottle);
+    QueryThrottle *throttleSlot() const { return slot; }
+    const QList<Row> &lookahead(qint32 n);
+
+protected:
+    //! produce the next row, return false if there are no more rows
+    virtual bool fetch(Row &row) = 0;
+    //! append all rows up to the end of the open cursor and close it
+    virtual void closeCursor(QList<Row> &rows) { Q_UNUSED(rows) }
+
+    QString lastError;
+
+private:
+    void releaseSlot();
+
+    Row current;
+    QList<Row> buffered;
+    QueryThrottle *slot;
+};
+
+//! The rows of an executed SQL query.
+class QueryRowSource : public RowSource
+{
+public:
+    explicit QueryRowSource(const QSqlQuery &aQuery);
+
+    bool holdsCursor() const override { return query.isActive(); }
+
+protected:
+    bool fetch(Row &row) override;
+    void closeCursor(QList<Row> &rows) override;
+
+private:
+    QSqlQuery query;
+    QStringList fieldNames;
+};
+
+//! Rows already read into memory, e.g. from a cache.
+class MemoryRowSource : public RowSource
+{
+public:
+    explicit MemoryRowSource(const QList<Row> &aRows);
+
+protected:
+    bool fetch(Row &row) override;
+
+private:
+    QList<Row> rows;
+    qsizetype pos;
+};
+
+//! The elements of a JSON array or a delimited list stored in a single
+//! value. The JSON array is read element by element, only a single element
+//! is parsed at once. Every row contains the element as __VALUE, the position
+//! as __INDEX and for JSON objects all fields with their names.
+class ListRowSource : public RowSource
+{
+public:
+    explicit ListRowSource(const QByteArray &aData, const QString &aFormat);
+
+protected:
+    bool fetch(Row &row) override;
+
+private:
+    bool nextJsonElement(QByteArray &element);
+    bool nextDelimitedElement(QByteArray &element);
+
+    QByteArray data;
+    QByteArray delimiter;
+    bool json;
+    qsizetype pos;
+    qint32 index;
+};
+
+//! The rows of a large query read in pages using keyset pagination on an
+//! ordered and unique key column. Every page is a new statement, so no cursor
+//! and no snapshot is held between the pages. The page size is doubled or
+//! halved to keep the fetch time of a page near the target time.
+class KeysetRowSource : public RowSource
+{
+public:
+    KeysetRowSource(QSqlDatabase aDb, const QString &aDbType, const QString &aSql,
+                    const QString &aKey, qint32 aPageSize, qint32 aTargetMs);
+
+    QString statistics() const override;
+    bool holdsCursor() const override { return query.isActive(); }
+
+protected:
+    bool fetch(Row &row) override;
+    void closeCursor(QList<Row> &rows) override;
+
+private:
+    bool nextPage();
+    bool readPageRow(Row &row);
+    void endPage();
+    void adaptPageSize();
+
+    QSqlDatabase db;
+    QString dbType;
+    QString sql;
+    QString key;
+    QSqlQuery query;
+    QStringList fieldNames;
+    qint32 keyIndex;
+    QVariant lastKey;
+    qint32 pageSize;
+    qint32 targetMs;
+    qint32 pageRows;
+    qint32 requestedRows;
+    qint32 pageCount;
+    bool morePages;
+    qint64 pageNanos;
+    quint64 rowCount;
+};
+
+//! All rows of a parent/child table read with a single query. The rows are
+//! kept in memory together with an index from every id to its children.
+class HierarchyIndex
+{
+public:
+    HierarchyIndex(const QString &aName, QSqlQuery &aQuery,
+                   const QString &aIdColumn, const QString &aParentColumn);
+
+    QString getName() const { return name; }
+    QString getLastError() const { return lastError; }
+    QStringList getFieldNames() const { return fieldNames; }
+    qint32 nodeCount() const { return static_cast<qint32>(rows.size()); }
+    qint32 unreachableCount() const { return unreachable; }
+
+    QList<qint32> roots() const { return rootNodes; }
+    QList<qint32> children(qint32 node) const { return childNodes.value(id(node)); }
+    const QVariantList &values(qint32 node) const { return rows.at(node); }
+    QString id(qint32 node) const { return rows.at(node).at(idIndex).toString(); }
+
+private:
+    QString name;
+    QString lastError;
+    QStringList fieldNames;
+    QList<QVariantList> rows;
+    qint32 idIndex;
+    QList<qint32> rootNodes;
+    QHash<QString, QList<qint32> > childNodes;
+    qint32 unreachable;
+};
+
+//! The nodes of one level of a hierarchy. A nested call of the same block
+//! creates the source for the children of the current node, the depth
+//! starting with 0 and the path of ids separated by / are added as
+//! __DEPTH and __PATH.
+class HierarchyRowSource : public RowSource
+{
+public:
+    explicit HierarchyRowSource(QSharedPointer<HierarchyIndex> aIndex);
+
+    QString getName() const { return index->getName(); }
+    HierarchyRowSource *childSource() const;
+
+protected:
+    bool fetch(Row &row) override;
+
+private:
+    HierarchyRowSource(QSharedPointer<HierarchyIndex> aIndex, const QList<qint32> &aNodes,
+                       qint32 aDepth, const QString &aParentPath);
+
+    QSharedPointer<HierarchyIndex> index;
+    QList<qint32> nodes;
+    qint32 depth;
+    QString parentPath;
+    qsizetype pos;
+    qint32 currentNode;
+    QString currentPath;
+};
+
+//! A long format query (row key, column key, value) read in one pass into
+//! a crosstab. Every row contains the row key, a field for every column
+//! and the column names and values as JSON arrays __COLUMNS and __VALUES
+//! for templates with dynamic columns. Values of the same cell are summed.
+class PivotRowSource : public RowSource
+{
+public:
+    PivotRowSource(QSqlQuery &aQuery, const QString &aRowKey, const QString &aColumnKey,
+                   const QString &aValue, const QVariant &aDefault, const QStringList &aColumns);
+
+    QString statistics() const override;
+
+protected:
+    bool fetch(Row &row) override;
+
+private:
+    QString rowKey;
+    QVariant defaultValue;
+    QStringList columns;
+    QStringList rowKeys;
+    QList<QVariantList> cells;
+    QByteArray columnsJson;
+    qsizetype pos;
+    quint64 readRows;
+};
+
+//! The rows of a child query ordered by the join key, shared by all calls
+//! of the child block for one parent block. The cursor advances in lockstep
+//! with the parent rows, only the next row is kept in memory. Both results
+//! must be ordered by the key in the same way.
+class MergeCursor
+{
+public:
+    MergeCursor(QSqlDatabase aDb, const QString &aSql, const QString &aKey);
+
+    bool open();
+    bool next(const QVariant &aKey, RowSource::Row &row);
+
+    QString getLastError() const { return lastError; }
+    bool isUnordered() const { return unordered; }
+    QString statistics() const;
+
+private:
+    bool readPending();
+
+    QSqlDatabase db;
+    QString sql;
+    QString key;
+    QSqlQuery query;
+    QStringList fieldNames;
+    qint32 keyIndex;
+    RowSource::Row pending;
+    bool hasPending;
+    bool exhausted;
+    QVariant lastParentKey;
+    QVariant lastChildKey;
+    bool unordered;
+    QString lastError;
+    quint64 rowCount;
+    quint64 skipped;
+};
+
+//! The rows of a merge cursor for one key of the parent block.
+class MergeRowSource : public RowSource
+{
+public:
+    MergeRowSource(MergeCursor *aCursor, const QVariant &aKey);
+
+protected:
+    bool fetch(Row &row) override;
+
+private:
+    MergeCursor *cursor;
+    QVariant key;
+};
+
+#endif // ROWSOURCE_H
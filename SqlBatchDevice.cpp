@@ -0,0 +1,492 @@
+#include "SqlBatchDevice.h"
+#include "QueryThrottle.h"
+#include "SqlDialect.h"
+
+#include <QRegularExpression>
+#include <QtSql/QSqlDriver>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+//! upper limit of statements for one execBatch call, a smaller transaction
+//! size flushes the batch earlier
+static const int maxBatchRows = 5000;
+
+static bool isIdentifierChar(QChar c)
+{
+    return c.isLetterOrNumber() || c == '_' || c == '$' || c == '.';
+}
+
+SqlBatchDevice::SqlBatchDevice(QSqlDatabase database, int aTransactionSize,
+                               LogMessage *l, QObject *parentObj)
+    : QIODevice(parentObj),
+      db(database),
+      logger(l),
+      transactionSize(aTransactionSize),
+      useTransactions(false),
+      usePrepared(false),
+      failed(false),
+      buffer(),
+      scanPos(0),
+      scanState(0),
+      pendingShape(""),
+      pendingStatements(),
+      pendingColumns(),
+      pendingRows(0),
+      txStatements(0),
+      statementCount(0),
+      batchCount(0),
+      transactionCount(0)
+{
+}
+
+SqlBatchDevice::~SqlBatchDevice()
+{
+    try
+    {
+        if (isOpen())
+        {
+            close();
+        }
+    }
+    catch (...)
+    {
+        // catch all exception
+    }
+}
+
+bool SqlBatchDevice::open(OpenMode mode)
+{
+    if (!db.isOpen())
+    {
+        logger->errorMsg(tr("batch execution needs an open database connection"));
+        return false;
+    }
+
+    useTransactions = transactionSize > 0 && db.driver()->hasFeature(QSqlDriver::Transactions);
+    usePrepared = db.driver()->hasFeature(QSqlDriver::PreparedQueries);
+    if (!db.driver()->hasFeature(QSqlDriver::BatchOperations))
+    {
+        logger->infoMsg(tr("driver %1 emulates batch operations").arg(db.driverName()));
+    }
+
+    failed = false;
+    buffer.clear();
+    scanPos = 0;
+    scanState = 0;
+    pendingRows = 0;
+    statementCount = 0;
+    batchCount = 0;
+    transactionCount = 0;
+
+    beginTransaction();
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void SqlBatchDevice::close()
+{
+    if (!isOpen())
+    {
+        return;
+    }
+
+    // the last statement doesn't need a terminating semicolon
+    addStatement(QString::fromUtf8(buffer).trimmed());
+    buffer.clear();
+    scanPos = 0;
+
+    flushPending();
+    commitTransaction();
+
+    logger->infoMsg(tr("executed %1 statements using %2 batches in %3 transactions%4")
+                    .arg(statementCount).arg(batchCount).arg(transactionCount)
+                    .arg(failed ? tr(" (failed)") : QString("")));
+
+    QIODevice::close();
+}
+
+qint64 SqlBatchDevice::readData(char *data, qint64 maxSize)
+{
+    Q_UNUSED(data)
+    Q_UNUSED(maxSize)
+
+    return -1;
+}
+
+qint64 SqlBatchDevice::writeData(const char *data, qint64 maxSize)
+{
+    buffer.append(data, maxSize);
+    splitStatements();
+
+    // after an error we consume the rest of the output silently
+    return maxSize;
+}
+
+//! Search the buffer for semicolons outside of string literals, quoted
+//! names and comments, every found statement is added and removed from
+//! the buffer. The scan continues with the next written part.
+void SqlBatchDevice::splitStatements()
+{
+    qsizetype start = 0;
+    qsizetype end;
+
+    while ((end = SqlDialect::statementEnd(buffer, scanPos, scanState)) >= 0)
+    {
+        addStatement(QString::fromUtf8(buffer.constData() + start, end - start).trimmed());
+        start = scanPos;
+    }
+
+    buffer.remove(0, start);
+    scanPos -= start;
+}
+
+void SqlBatchDevice::addStatement(const QString &stmt)
+{
+    if (failed || stmt.isEmpty())
+    {
+        return;
+    }
+
+    statementCount++;
+
+    QString shape;
+    QVariantList values;
+    if (usePrepared && parameterize(stmt, shape, values))
+    {
+        if (pendingRows > 0 && (shape != pendingShape || pendingRows >= maxBatchRows))
+        {
+            flushPending();
+        }
+
+        if (0 == pendingRows)
+        {
+            pendingShape = shape;
+            pendingStatements.clear();
+            pendingColumns.clear();
+            for (int i = 0; i < values.size(); ++i)
+            {
+                pendingColumns.append(QVariantList());
+            }
+        }
+
+        for (int i = 0; i < values.size(); ++i)
+        {
+            pendingColumns[i].append(values.at(i));
+        }
+        pendingStatements.append(stmt);
+        pendingRows++;
+    }
+    else
+    {
+        // no DML statement, keep the order and execute it directly
+        if (flushPending())
+        {
+            QSqlQuery q(db);
+            bool ok = false;
+            {
+                ThrottleGuard guard(db);
+                ok = q.exec(stmt);
+            }
+            if (!ok)
+            {
+                logger->errorMsg(tr("executing SQL '%1' (%2)").arg(stmt, q.lastError().text()));
+                failed = true;
+                if (useTransactions) db.rollback();
+            }
+        }
+    }
+
+    if (transactionSize > 0 && ++txStatements >= transactionSize)
+    {
+        flushPending();
+        commitTransaction();
+        beginTransaction();
+    }
+}
+
+//! Returns true if the literal ending at pos is a complete value, it isn't
+//! part of an expression like 'a' || 'b' or x + 1.
+static bool endsValue(const QString &stmt, qsizetype pos)
+{
+    while (pos < stmt.size() && stmt.at(pos).isSpace()) ++pos;
+    return pos >= stmt.size() || stmt.at(pos).isLetter()
+            || ',' == stmt.at(pos) || ')' == stmt.at(pos) || ';' == stmt.at(pos);
+}
+
+//! Replace the string and number literals at value positions of a DML
+//! statement by positional placeholders. Value positions are the elements
+//! of a VALUES list and the right side of a comparison or assignment like
+//! SET col = 5 or WHERE col = 'x'. The resulting shape is identical for
+//! statements which differs only in their values and the values are
+//! returned in order.
+//! \return false if the statement can't send as prepared statement
+bool SqlBatchDevice::parameterize(const QString &stmt, QString &shape, QVariantList &values) const
+{
+    static const QRegularExpression dmlStart("^(INSERT|UPDATE|DELETE|MERGE)\\b",
+                                             QRegularExpression::CaseInsensitiveOption);
+    // column positions, row limits, type sizes and typed literals aren't values,
+    // comments can contain quotes
+    static const QRegularExpression noValues(
+                "\\b(GROUP\\s+BY|ORDER\\s+BY|LIMIT|OFFSET|FETCH|TOP)\\b"
+                "|\\b(DATE|TIME|TIMESTAMP|INTERVAL)\\s*'"
+                "|\\b(DECIMAL|NUMERIC|NUMBER|CHAR|NCHAR|VARCHAR|VARCHAR2|NVARCHAR|FLOAT|BINARY|VARBINARY)\\s*\\("
+                "|--|/\\*",
+                QRegularExpression::CaseInsensitiveOption);
+    static const QStringList comparisons = QStringList() << "=" << "<" << ">" << "<=" << ">="
+                                                         << "<>" << "!=" << "LIKE";
+
+    if (!dmlStart.match(stmt).hasMatch() || noValues.match(stmt).hasMatch())
+    {
+        return false;
+    }
+
+    shape.clear();
+    shape.reserve(stmt.size());
+    values.clear();
+
+    QString prev;               // the last token, whitespace isn't a token
+    int depth = 0;
+    int valuesDepth = -1;       // the depth of the VALUES keyword, -1 outside of a VALUES list
+    qsizetype len = stmt.size();
+    qsizetype i = 0;
+    while (i < len)
+    {
+        QChar c = stmt.at(i);
+        qsizetype s = i;
+        bool valuePos = ("(" == prev || "," == prev) ? (valuesDepth >= 0 && depth == valuesDepth + 1)
+                                                     : comparisons.contains(prev);
+        if (c.isSpace())
+        {
+            shape += c;
+            ++i;
+        }
+        else if ('\'' == c)
+        {
+            QString v;
+            ++i;
+            while (i < len)
+            {
+                if ('\'' == stmt.at(i))
+                {
+                    if (i + 1 < len && '\'' == stmt.at(i + 1))
+                    {
+                        v += QChar('\'');
+                        i += 2;
+                        continue;
+                    }
+                    break;
+                }
+                v += stmt.at(i++);
+            }
+            if (i >= len) return false;     // unterminated string literal
+            ++i;
+            if (valuePos && endsValue(stmt, i))
+            {
+                shape += QChar('?');
+                values.append(v);
+            }
+            else
+            {
+                shape += stmt.mid(s, i - s);
+            }
+            prev = "'";
+        }
+        else if ('"' == c || '`' == c || '[' == c)
+        {
+            // quoted identifier, copied unchanged
+            qsizetype end = stmt.indexOf('[' == c ? QChar(']') : c, i + 1);
+            if (end < 0) return false;
+            shape += stmt.mid(i, end - i + 1);
+            i = end + 1;
+            prev = "\"";
+        }
+        else if ('?' == c || (':' == c && i + 1 < len && stmt.at(i + 1).isLetter()))
+        {
+            // the statement contains placeholder syntax, don't touch it
+            return false;
+        }
+        else if ((c.isDigit() || ('-' == c && valuePos && i + 1 < len && stmt.at(i + 1).isDigit()))
+                 && (0 == i || !isIdentifierChar(stmt.at(i - 1))))
+        {
+            bool real = false;
+            if ('-' == c) ++i;
+            while (i < len && stmt.at(i).isDigit()) ++i;
+            if (i < len && '.' == stmt.at(i))
+            {
+                real = true;
+                ++i;
+                while (i < len && stmt.at(i).isDigit()) ++i;
+            }
+            if (i + 1 < len && ('e' == stmt.at(i) || 'E' == stmt.at(i)))
+            {
+                qsizetype e = i + 1;
+                if (('+' == stmt.at(e) || '-' == stmt.at(e)) && e + 1 < len) ++e;
+                if (stmt.at(e).isDigit())
+                {
+                    real = true;
+                    i = e;
+                    while (i < len && stmt.at(i).isDigit()) ++i;
+                }
+            }
+
+            QString num = stmt.mid(s, i - s);
+            if (i < len && isIdentifierChar(stmt.at(i)))
+            {
+                // part of a name like 2ndColumn
+                while (i < len && isIdentifierChar(stmt.at(i))) ++i;
+                shape += stmt.mid(s, i - s);
+                prev = stmt.mid(s, i - s).toUpper();
+                continue;
+            }
+
+            bool ok = false;
+            QVariant v = real ? QVariant(num.toDouble(&ok)) : QVariant(num.toLongLong(&ok));
+            if (valuePos && endsValue(stmt, i))
+            {
+                shape += QChar('?');
+                values.append(ok ? v : QVariant(num));
+            }
+            else
+            {
+                shape += num;
+            }
+            prev = "0";
+        }
+        else if (isIdentifierChar(c))
+        {
+            while (i < len && isIdentifierChar(stmt.at(i))) ++i;
+            prev = stmt.mid(s, i - s).toUpper();
+            shape += stmt.mid(s, i - s);
+            if ("VALUES" == prev)
+            {
+                valuesDepth = depth;
+            }
+            else if (depth == valuesDepth)
+            {
+                // e.g. ON CONFLICT or RETURNING after the values
+                valuesDepth = -1;
+            }
+        }
+        else if ('=' == c || '<' == c || '>' == c || '!' == c)
+        {
+            while (i < len && ('=' == stmt.at(i) || '<' == stmt.at(i) || '>' == stmt.at(i) || '!' == stmt.at(i))) ++i;
+            prev = stmt.mid(s, i - s);
+            shape += prev;
+        }
+        else
+        {
+            if ('(' == c) depth++;
+            if (')' == c) depth--;
+            shape += c;
+            prev = QString(c);
+            ++i;
+        }
+    }
+
+    return true;
+}
+
+//! Execute the collected statements, a single statement is executed
+//! without preparing it first. If the batch fails the statements are
+//! executed one by one, inside of a transaction a savepoint removes the
+//! rows of the partly executed batch first.
+bool SqlBatchDevice::flushPending()
+{
+    if (failed)
+    {
+        pendingRows = 0;
+        return false;
+    }
+
+    if (0 == pendingRows)
+    {
+        return true;
+    }
+
+    QSqlQuery q(db);
+    bool ok = false;
+    QString failedStmt = pendingStatements.first();
+    if (1 == pendingRows)
+    {
+        ThrottleGuard guard(db);
+        ok = q.exec(failedStmt);
+    }
+    else
+    {
+        bool savepoint = useTransactions && QSqlQuery(db).exec("SAVEPOINT sr_batch");
+        bool prepared = q.prepare(pendingShape);
+        if (prepared)
+        {
+            for (int i = 0; i < pendingColumns.size(); ++i)
+            {
+                q.addBindValue(pendingColumns.at(i));
+            }
+            ThrottleGuard guard(db);
+            ok = q.execBatch();
+        }
+        batchCount++;
+
+        // without savepoint only a batch which isn't started can be repeated
+        if (!ok && (savepoint || !prepared))
+        {
+            logger->warnMsg(tr("batch of %1 statements failed, executing them one by one (%2)")
+                            .arg(pendingRows).arg(q.lastError().text()));
+            if (savepoint) QSqlQuery(db).exec("ROLLBACK TO SAVEPOINT sr_batch");
+            ok = true;
+            for (qsizetype i = 0; ok && i < pendingStatements.size(); ++i)
+            {
+                // every round trip takes its own token of the query rate
+                ThrottleGuard guard(db);
+                failedStmt = pendingStatements.at(i);
+                q = QSqlQuery(db);
+                ok = q.exec(failedStmt);
+            }
+        }
+        if (ok && savepoint)
+        {
+            QSqlQuery(db).exec("RELEASE SAVEPOINT sr_batch");
+        }
+    }
+
+    if (!ok)
+    {
+        logger->errorMsg(tr("executing SQL '%1' of %2 statements (%3)")
+                         .arg(failedStmt).arg(pendingRows).arg(q.lastError().text()));
+        failed = true;
+        if (useTransactions) db.rollback();
+    }
+
+    pendingRows = 0;
+    pendingColumns.clear();
+    pendingStatements.clear();
+
+    return ok;
+}
+
+void SqlBatchDevice::beginTransaction()
+{
+    txStatements = 0;
+    if (useTransactions && !failed)
+    {
+        if (db.transaction())
+        {
+            transactionCount++;
+        }
+        else
+        {
+            logger->warnMsg(tr("can't start transaction, using autocommit (%1)").arg(db.lastError().text()));
+            useTransactions = false;
+        }
+    }
+}
+
+bool SqlBatchDevice::commitTransaction()
+{
+    if (useTransactions && !failed && !db.commit())
+    {
+        logger->errorMsg(tr("commit failed (%1)").arg(db.lastError().text()));
+        failed = true;
+        db.rollback();
+    }
+
+    return !failed;
+}
@@ -0,0 +1,69 @@
+#ifndef SQLBATCHDEVICE_H
+#define SQLBATCHDEVICE_H
+
+#include <QIODevice>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVariantList>
+#include <QtSql/QSqlDatabase>
+#include "logmessage.h"
+
+//! This device receives the generated output of a query set and executes
+//! every statement (terminated by a semicolon) at the given database.
+//! Consecutive statements with the same structure are send as one
+//! execBatch call with bound value arrays and the statements are grouped
+//! into transactions of transactionSize statements.
+class SqlBatchDevice : public QIODevice
+{
+    Q_OBJECT
+    Q_CLASSINFO ("author", "St. Koehler")
+    Q_CLASSINFO ("company", "com.github.mosling")
+
+public:
+    explicit SqlBatchDevice(QSqlDatabase database, int transactionSize,
+                            LogMessage *l, QObject *parentObj = nullptr);
+    ~SqlBatchDevice() override;
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override { return true; }
+
+    bool hasFailed() const { return failed; }
+    quint64 getStatementCount() const { return statementCount; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    void splitStatements();
+    void addStatement(const QString &stmt);
+    bool parameterize(const QString &stmt, QString &shape, QVariantList &values) const;
+    bool flushPending();
+    void beginTransaction();
+    bool commitTransaction();
+
+    QSqlDatabase db;
+    LogMessage *logger;
+    int transactionSize;
+    bool useTransactions;
+    bool usePrepared;
+    bool failed;
+
+    QByteArray buffer;
+    qsizetype scanPos;
+    char scanState;
+
+    QString pendingShape;
+    QStringList pendingStatements;
+    QList<QVariantList> pendingColumns;
+    int pendingRows;
+    int txStatements;
+
+    quint64 statementCount;
+    quint64 batchCount;
+    quint64 transactionCount;
+};
+
+#endif // SQLBATCHDEVICE_H
@@ -0,0 +1,226 @@
+#include "SqlDialect.h"
+
+#include <QRegularExpression>
+
+//! Restrict the number of rows returned by the given select statement. The
+//! backend of an ODBC connection is unknown, the statement is unchanged and
+//! the rows are only limited by the client.
+//! \return the statement with a LIMIT, TOP, ROWS or FETCH FIRST clause
+QString SqlDialect::limitQuery(const QString &dbType, const QString &aSql, qint32 rows)
+{
+    QString type = dbType.toUpper();
+    if ("QODBC" == type)
+    {
+        return aSql;
+    }
+
+    // a clause can't follow a semicolon or a line comment
+    QString sql = trimStatement(aSql);
+    if ("QTDS" == type)
+    {
+        static const QRegularExpression selectStart("^\\s*SELECT\\s+(DISTINCT\\s+)?",
+                                                    QRegularExpression::CaseInsensitiveOption);
+        QRegularExpressionMatch m = selectStart.match(sql);
+        if (m.hasMatch() && !sql.mid(m.capturedEnd()).startsWith("TOP ", Qt::CaseInsensitive))
+        {
+            return sql.left(m.capturedEnd()) + QString("TOP %1 ").arg(rows) + sql.mid(m.capturedEnd());
+        }
+        return QString("SELECT TOP %1 * FROM (").arg(rows) + sql + ") sr_limit";
+    }
+
+    // a statement with its own limit is used as sub query
+    static const QRegularExpression ownLimit("\\b(LIMIT\\s+\\d+(\\s+OFFSET\\s+\\d+)?|ROWS\\s+\\d+|ONLY)\\s*$",
+                                             QRegularExpression::CaseInsensitiveOption);
+    QString limitSql = ownLimit.match(sql).hasMatch() ? "SELECT * FROM (" + sql + ") sr_limit" : sql;
+
+    if ("QIBASE" == type)
+    {
+        return limitSql + QString(" ROWS %1").arg(rows);
+    }
+    else if ("QOCI" == type || "QDB2" == type)
+    {
+        return limitSql + QString(" FETCH FIRST %1 ROWS ONLY").arg(rows);
+    }
+
+    // QSQLITE, QPSQL, QMYSQL and QMARIADB
+    return limitSql + QString(" LIMIT %1").arg(rows);
+}
+
+//! Remove the semicolons, comments and white space at the end of the
+//! statement, so a clause can be appended.
+QString SqlDialect::trimStatement(const QString &sql)
+{
+    qsizetype codeEnd = 0;
+    QChar state;
+
+    for (qsizetype i = 0; i < sql.size(); ++i)
+    {
+        QChar c = sql.at(i);
+        QChar n = i + 1 < sql.size() ? sql.at(i + 1) : QChar();
+        if ('-' == state)
+        {
+            if ('\n' == c) state = QChar();
+        }
+        else if ('*' == state)
+        {
+            if ('*' == c && '/' == n)
+            {
+                state = QChar();
+                ++i;
+            }
+        }
+        else if (!state.isNull())
+        {
+            if (c == state) state = QChar();
+            codeEnd = i + 1;
+        }
+        else if (('-' == c && '-' == n) || ('/' == c && '*' == n))
+        {
+            state = n;
+            ++i;
+        }
+        else if (!c.isSpace() && ';' != c)
+        {
+            if ('\'' == c || '"' == c || '`' == c) state = c;
+            codeEnd = i + 1;
+        }
+    }
+
+    return sql.left(codeEnd);
+}
+
+//! Split the text at semicolons outside of string literals, quoted names
+//! and comments.
+//! \return the non empty statements without the semicolon
+QStringList SqlDialect::splitStatements(const QString &sql)
+{
+    QStringList statements;
+    QByteArray text = sql.toUtf8();
+    qsizetype start = 0;
+    qsizetype pos = 0;
+    char state = 0;
+    qsizetype end;
+
+    while ((end = statementEnd(text, pos, state)) >= 0)
+    {
+        statements << QString::fromUtf8(text.constData() + start, end - start).trimmed();
+        start = pos;
+    }
+    statements << QString::fromUtf8(text.constData() + start, text.size() - start).trimmed();
+    statements.removeAll(QString(""));
+
+    return statements;
+}
+
+//! Search the next semicolon which ends a statement, starting at pos. The
+//! semicolons of string literals, quoted names and -- or /* */ comments are
+//! skipped. The state (0, the open quote character, '-' for a line comment
+//! or '*' for a block comment) is kept between the calls, so a text that
+//! arrives in parts can be scanned piece by piece.
+//! \return the position of the semicolon or -1 at the end of the text, pos
+//!         is the position to continue with
+qsizetype SqlDialect::statementEnd(QByteArrayView sql, qsizetype &pos, char &state)
+{
+    for (; pos < sql.size(); ++pos)
+    {
+        char c = sql.at(pos);
+        if ('-' == state)
+        {
+            if ('\n' == c) state = 0;
+        }
+        else if ('*' == state)
+        {
+            if ('*' == c)
+            {
+                if (pos + 1 >= sql.size()) return -1;      // the next part decides
+                if ('/' == sql.at(pos + 1))
+                {
+                    state = 0;
+                    ++pos;
+                }
+            }
+        }
+        else if (0 != state)
+        {
+            if (c == state) state = 0;
+        }
+        else if ('\'' == c || '"' == c || '`' == c)
+        {
+            state = c;
+        }
+        else if ('-' == c || '/' == c)
+        {
+            if (pos + 1 >= sql.size()) return -1;          // the next part decides
+            char n = sql.at(pos + 1);
+            if (('-' == c && '-' == n) || ('/' == c && '*' == n))
+            {
+                state = n;
+                ++pos;
+            }
+        }
+        else if (';' == c)
+        {
+            return pos++;
+        }
+    }
+
+    return -1;
+}
+
+SqlDialect::SqlDialect()
+{
+}
+
+//! Wrap the query into a select of one text column, the concatenation of
+//! the texts and the column values: text0 column0 text1 ... textN. NULL
+//! values are empty strings.
+//! \return the rendering query or an empty string for unsupported databases
+QString SqlDialect::renderQuery(const QString &dbType, const QString &sql,
+                                const QStringList &texts, const QStringList &columns)
+{
+    QString type = dbType.toUpper();
+    bool mysql = "QMYSQL" == type || "QMARIADB" == type;
+    bool mssql = "QODBC" == type || "QTDS" == type;
+
+    // Oracle and the CONCAT function convert the values and ignore NULL
+    QString columnFormat("%1");
+    if ("QSQLITE" == type || "QPSQL" == type)
+    {
+        columnFormat = "COALESCE(CAST(%1 AS TEXT), '')";
+    }
+    else if (mysql)
+    {
+        columnFormat = "COALESCE(CAST(%1 AS CHAR), '')";
+    }
+    else if (!mssql && "QOCI" != type)
+    {
+        return QString("");
+    }
+
+    QStringList parts;
+    for (qsizetype i = 0; i < texts.size(); ++i)
+    {
+        if (!texts.at(i).isEmpty())
+        {
+            QString literal = texts.at(i);
+            literal.replace("'", "''");
+            if (mysql) literal.replace("\\", "\\\\");
+            parts << "'" + literal + "'";
+        }
+        if (i < columns.size())
+        {
+            QString column = columns.at(i);
+            if (mysql)      column = "`" + column + "`";
+            else if (mssql) column = "[" + column + "]";
+            else            column = "\"" + column + "\"";
+            parts << columnFormat.arg(column);
+        }
+    }
+    if (parts.size() < 2)
+    {
+        parts << "''";
+    }
+
+    QString expr = (mysql || mssql) ? "CONCAT(" + parts.join(", ") + ")" : parts.join(" || ");
+    return "SELECT " + expr + " AS sr_line FROM (" + sql + ") sr_render";
+}
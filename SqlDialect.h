@@ -0,0 +1,24 @@
+#ifndef SQLDIALECT_H
+#define SQLDIALECT_H
+
+#include <QByteArrayView>
+#include <QString>
+#include <QStringList>
+
+//! Small helpers to create database specific SQL statements, the
+//! dialect is selected by the Qt driver name (QSQLITE, QPSQL, ...).
+class SqlDialect
+{
+public:
+    static QString limitQuery(const QString &dbType, const QString &sql, qint32 rows);
+    static QString trimStatement(const QString &sql);
+    static QStringList splitStatements(const QString &sql);
+    static qsizetype statementEnd(QByteArrayView sql, qsizetype &pos, char &state);
+    static QString renderQuery(const QString &dbType, const QString &sql,
+                               const QStringList &texts, const QStringList &columns);
+
+private:
+    SqlDialect();
+};
+
+#endif // SQLDIALECT_H
@@ -113,6 +113,11 @@ void SqlReport::on_But_OK_clicked()
     logger->setDebugFlag(ui.checkBoxDebug->checkState());
     vpExecutor.setLogger(logger);
 	vpExecutor.setPrepareQueriesFlag(ui.checkBoxPrepare->isChecked());
+	vpExecutor.setPreviewFlag(ui.checkBoxPreview->isChecked());
+	vpExecutor.setConnectionSet(&databaseSet);
+	connect(&vpExecutor, &QueryExecutor::watermarkAdvanced, this, [this]() {
+		mQuerySet.writeXml("", databaseSet);
+	});
 
 	if (activeQuerySetEntry->getBatchrun())
 	{
@@ -24,6 +24,21 @@ QString Utility::formatMilliSeconds(qint64 ms)
     return s;
 }
 
+//! Compare numbers as numbers and all other values as strings.
+//! \return a negative value, 0 or a positive value like QString::compare
+int Utility::compareValues(const QVariant &a, const QVariant &b)
+{
+    bool okA = false, okB = false;
+    double da = a.toDouble(&okA);
+    double db = b.toDouble(&okB);
+    if (okA && okB)
+    {
+        return da < db ? -1 : (da > db ? 1 : 0);
+    }
+
+    return QString::compare(a.toString(), b.toString());
+}
+
 Utility::Utility()
 {
 }
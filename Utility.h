@@ -5,11 +5,13 @@
 #define UTILITY_H
 
 #include <QString>
+#include <QVariant>
 
 class Utility
 {
 public:
     static QString formatMilliSeconds(qint64 ms);
+    static int compareValues(const QVariant &a, const QVariant &b);
 
 private:
 	Utility();
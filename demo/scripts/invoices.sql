@@ -0,0 +1,4 @@
+::MAIN
+::# the new invoices since the last run, the watermark is the highest InvoiceId
+select InvoiceId, InvoiceDate, BillingCountry, Total from Invoice
+where InvoiceId > ${__WATERMARK,0} order by InvoiceId
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""Compare the QSQLITE connection settings of the sqliteProfile option.
+
+The script uses the same URI parameters and pragmas as DbConnection and
+runs report like queries on an enlarged copy of binaries/chinook.sqlite
+(InvoiceLine doubled --scale times). Run it on the network share the
+reports read from, a warm local file shows only small differences.
+
+    python3 demo/sqlite_profile_bench.py --dir /mnt/share/tmp --scale 10
+"""
+
+import argparse
+import os
+import shutil
+import sqlite3
+import statistics
+import time
+
+QUERIES = [
+    ("genre totals",
+     "SELECT g.Name, sum(il.UnitPrice*il.Quantity) FROM InvoiceLine il"
+     " JOIN Track t ON t.TrackId = il.TrackId JOIN Genre g ON g.GenreId = t.GenreId"
+     " GROUP BY g.Name ORDER BY 2 DESC"),
+    ("track ranking",
+     "SELECT TrackId, count(*) c FROM InvoiceLine GROUP BY TrackId ORDER BY c DESC LIMIT 100"),
+    ("distinct",
+     "SELECT count(DISTINCT InvoiceId || '-' || TrackId) FROM InvoiceLine"),
+]
+
+# DbConnection::applySqliteProfile
+PROFILE_PRAGMAS = ("PRAGMA mmap_size=268435456", "PRAGMA cache_size=-65536",
+                   "PRAGMA temp_store=MEMORY", "PRAGMA query_only=ON")
+
+
+def create_database(source, target, scale):
+    shutil.copy(source, target)
+    con = sqlite3.connect(target)
+    cols = [r[1] for r in con.execute("PRAGMA table_info(InvoiceLine)")][1:]
+    col_list = ", ".join(cols)
+    for _ in range(scale):
+        con.execute(f"INSERT INTO InvoiceLine ({col_list}) SELECT {col_list} FROM InvoiceLine")
+    con.commit()
+    con.close()
+
+
+def plain(path):
+    return sqlite3.connect(path)
+
+
+def profile(path, mode="immutable=1"):
+    con = sqlite3.connect(f"file:{os.path.abspath(path)}?{mode}", uri=True)
+    for p in PROFILE_PRAGMAS:
+        con.execute(p)
+    return con
+
+
+def memory(path):
+    # DbConnection::cloneSqlite, the tables are copied into a shared memory database
+    con = sqlite3.connect("file:sqlreport-bench?mode=memory&cache=shared", uri=True,
+                          isolation_level=None)
+    con.execute(f"ATTACH DATABASE 'file:{os.path.abspath(path)}?immutable=1' AS sr_source")
+    objects = con.execute("SELECT type, name, sql FROM sr_source.sqlite_master WHERE sql IS NOT NULL"
+                          " ORDER BY CASE type WHEN 'table' THEN 0 WHEN 'index' THEN 1 ELSE 2 END").fetchall()
+    con.execute("BEGIN")
+    for kind, name, sql in objects:
+        if name.startswith("sqlite_"):
+            continue
+        con.execute(sql)
+        if kind == "table":
+            con.execute(f'INSERT INTO main."{name}" SELECT * FROM sr_source."{name}"')
+    con.execute("COMMIT")
+    con.execute("DETACH DATABASE sr_source")
+    for p in PROFILE_PRAGMAS[1:]:
+        con.execute(p)
+    return con
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--source", default=os.path.join(os.path.dirname(__file__), "..",
+                                                         "binaries", "chinook.sqlite"))
+    parser.add_argument("--dir", default="/tmp", help="directory of the enlarged database")
+    parser.add_argument("--scale", type=int, default=10, help="InvoiceLine is doubled scale times")
+    parser.add_argument("--rounds", type=int, default=5)
+    args = parser.parse_args()
+
+    db = os.path.join(args.dir, f"chinook_bench_{args.scale}.sqlite")
+    if not os.path.exists(db):
+        create_database(args.source, db, args.scale)
+    print(f"{db}: {os.path.getsize(db) / 1e6:.0f} MB, sqlite {sqlite3.sqlite_version}")
+
+    variants = [("plain", plain), ("readonly", lambda p: profile(p, "mode=ro")),
+                ("immutable", profile), ("memory", memory)]
+    times = {}
+    for _ in range(args.rounds):
+        for name, connect in variants:
+            t = time.perf_counter()
+            con = connect(db)
+            times.setdefault(("connect", name), []).append(time.perf_counter() - t)
+            for query_name, sql in QUERIES:
+                t = time.perf_counter()
+                con.execute(sql).fetchall()
+                times.setdefault((query_name, name), []).append(time.perf_counter() - t)
+            con.close()
+
+    for query_name in ["connect"] + [q for q, _ in QUERIES]:
+        for name, _ in variants:
+            v = times[(query_name, name)]
+            print(f"{query_name:14} {name:10} best {min(v):.3f}s median {statistics.median(v):.3f}s")
+
+
+if __name__ == "__main__":
+    main()
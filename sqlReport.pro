@@ -29,12 +29,21 @@ SOURCES += main.cpp \
     QuerySetEntry.cpp \
     QuerySet.cpp \
     QueryExecutor.cpp \
+    RowSource.cpp \
+    LookupTable.cpp \
+    AdaptiveBlock.cpp \
     QTreeReporter.cpp \
     editwidget.cpp \
     DbConnectionSet.cpp \
     DbConnection.cpp \
     DbConnectionForm.cpp \
     Utility.cpp \
+    SqlBatchDevice.cpp \
+    SqlDialect.cpp \
+    QueryThrottle.cpp \
+    QueryRecorder.cpp \
+    ReplicaRouter.cpp \
+    FileTable.cpp \
     logmessage.cpp
 
 HEADERS  += \
@@ -43,12 +52,21 @@ HEADERS  += \
     QuerySetEntry.h \
     QuerySet.h \
     QueryExecutor.h \
+    RowSource.h \
+    LookupTable.h \
+    AdaptiveBlock.h \
     QTreeReporter.h \
     EditWidget.h \
     DbConnectionSet.h \
     DbConnection.h \
     DbConnectionForm.h \
     Utility.h \
+    SqlBatchDevice.h \
+    SqlDialect.h \
+    QueryThrottle.h \
+    QueryRecorder.h \
+    ReplicaRouter.h \
+    FileTable.h \
     logmessage.h
 
 FORMS    += \